@@ -1,9 +1,22 @@
 #include <assert.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /*
  * For running tests from a seperate file, structs and functions are
@@ -15,27 +28,100 @@
 // #include "cache_sim.h"
 // #else
 
-#define MASK(n) ((1U << (n)) - 1)
+#define MASK(n) (((n) >= 64) ? UINT64_MAX : (1ULL << (n)) - 1)
 
-/* direct mapped or fully associative*/
-typedef enum { dm, fa } cache_map_t;
+/* Valid bits of all blocks are packed 64 to a word */
+#define BLOCK_VALID(cache, i) (((cache)->valid[(i) >> 6] >> ((i) & 63)) & 1)
+#define SET_BLOCK_VALID(cache, i) ((cache)->valid[(i) >> 6] |= 1ULL << ((i) & 63))
+#define CLEAR_BLOCK_VALID(cache, i) ((cache)->valid[(i) >> 6] &= ~(1ULL << ((i) & 63)))
+
+/* direct mapped, fully associative or N-way set associative */
+typedef enum { dm, fa, sa } cache_map_t;
 /* Unified cache or split cache (instruction/data) */
 typedef enum { uc, sc } cache_org_t;
 typedef enum { instruction, data } access_t;
+/* Replacement policy of the associative mappings */
+typedef enum {
+  rp_fifo, rp_lru, rp_tree_plru, rp_bit_plru, rp_random, rp_lfu, rp_srrip
+} cache_policy_t;
+
+/* Write hit and write miss policy:
+ *  wp_wb:     write-back, write-allocate
+ *  wp_wt:     write-through, write-allocate
+ *  wp_wb_nwa: write-back, no-write-allocate
+ *  wp_wt_nwa: write-through, no-write-allocate
+ */
+typedef enum { wp_wb, wp_wt, wp_wb_nwa, wp_wt_nwa } write_policy_t;
+
+/* Hardware prefetcher of a cache:
+ *  pf_next_line: tagged next-line, on a miss or the first use of a
+ *                prefetched block the next block is prefetched
+ *  pf_stride:    stride detection per 4KB region, traces have no PCs
+ *  pf_stream:    stream buffers next to the cache, allocated on misses
+ */
+typedef enum { pf_none, pf_next_line, pf_stride, pf_stream } prefetch_t;
 
-typedef struct cache_block_t {
-  uint8_t byte[64];
-  uint32_t tag;
-  bool valid;
-} cache_block_t;
+/* FIFO ring of a single set, used by the associative mappings. The
+ * other policies only use it to fill the empty ways of a set in order.
+ * holes counts ways invalidated by a lower level of a hierarchy, they
+ * are refilled before anything is evicted.
+ */
+typedef struct cache_set_t {
+  uint32_t start;
+  uint32_t end;
+  bool is_full;
+  uint32_t holes;
+} cache_set_t;
 
 typedef struct cache_t {
-  /* start, end, and is_full to be used only with fully associative FIFO mechanism */
-  uint8_t length;
-  uint8_t start;
-  uint8_t end;
-  uint8_t is_full;
-  cache_block_t *block;
+  uint32_t length;
+  uint32_t sets;
+  uint32_t ways;
+  cache_set_t *set;
+  /* Tag only metadata of sets * ways blocks, the ways of a set are
+   * contiguous. Block data is never simulated, so it is not stored.
+   * Tags are packed in TAG_BITS bits, the low 32 in tag and the rest in
+   * tag_hi, which is only allocated once a tag does not fit 32 bits.
+   */
+  uint32_t *tag;
+  uint16_t *tag_hi;
+  uint64_t *valid;
+  /* Hashed tag index, only allocated for highly associative caches.
+   * Each set owns hash_size slots holding (way + 1), 0 marks an empty slot.
+   */
+  uint32_t hash_size;
+  uint8_t hash_shift;
+  uint32_t *hash;
+  /* Replacement state, only what the policy needs is allocated:
+   *  lru:       circular recency list per set, meta holds the previous
+   *             and next way of every block, set_state the most recent way
+   *  tree_plru: ways - 1 tree bits per set in bits, node n at bit n
+   *  bit_plru:  one MRU bit per block in bits, set_state counts them
+   *  lfu:       access count of every block in meta
+   *  srrip:     re-reference prediction value of every block in meta
+   *  random:    xorshift state in rng
+   */
+  cache_policy_t policy;
+  uint32_t *meta;
+  uint32_t *set_state;
+  uint64_t *bits;
+  uint64_t rng;
+  /* Tag of the block evicted by the last eviction */
+  uint64_t victim;
+  /* Dirty bits like valid, only allocated for write-back caches. Write
+   * misses bypass the cache without write-allocate.
+   */
+  uint64_t *dirty;
+  bool write_allocate;
+  uint64_t writebacks;
+  uint64_t write_around;
+  /* Evictions of this cache, kept per instance so caches can be simulated
+   * on different threads
+   */
+  uint64_t evicts;
+  /* Checkpoint the arrays may be mapped from, those are not freed */
+  const uint8_t *map;
+  size_t map_size;
 } cache_t;
 
 typedef struct cache_bits_t {
@@ -45,421 +131,6009 @@ typedef struct cache_bits_t {
 } cache_bits_t;
 
 typedef struct mem_access_t {
-  uint32_t address;
-  uint32_t tag;
+  uint64_t address;
+  uint64_t tag;
   uint32_t index;
   uint32_t offset;
   access_t accesstype;
+  bool write;
+  uint8_t core;
 } mem_access_t;
 
+/* Record encodings of the binary trace format */
+typedef enum { enc_fixed32, enc_fixed64, enc_delta } trace_enc_t;
+
+/* Header of a binary trace file, followed by the records.
+ *  enc_fixed32: uint32_t addresses, then a bitmap of access types and a
+ *               bitmap of writes
+ *  enc_fixed64: uint64_t (address << 2 | write << 1 | access type)
+ *  enc_delta:   LEB128 varint of (zigzag(address - previous) << 2 | write << 1
+ *               | access type)
+ * Version 1 traces have no write bit and bitmap, all accesses are reads.
+ */
+typedef struct trace_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t encoding;
+  uint64_t count;
+} trace_header_t;
+
+/* A memory trace, either text read in large blocks or binary mapped in
+ * memory. A binary trace read from a pipe is held in memory instead,
+ * map_owned tells to free it. Compressed traces are read from the output
+ * of a decompressor process, the feeder thread copies the compressed
+ * input from src_fd into it. records counts the records read or skipped,
+ * batches end at limit records unless it is 0.
+ */
+typedef struct trace_t {
+  int fd;
+  uint8_t *buf;
+  size_t buf_len;
+  size_t buf_pos;
+  bool eof;
+  const uint8_t *map;
+  size_t map_size;
+  bool map_owned;
+  pid_t child;
+  int src_fd;
+  int feed_fd;
+  pthread_t feeder;
+  bool feeding;
+  uint8_t prefix[8];
+  size_t prefix_len;
+  trace_enc_t encoding;
+  uint64_t count;
+  uint64_t pos;
+  const uint8_t *cursor;
+  const uint8_t *types;
+  const uint8_t *writes;
+  uint8_t flag_bits;
+  uint64_t prev;
+  uint64_t records;
+  uint64_t limit;
+} trace_t;
+
+/* Number of records read from the trace and simulated at a time */
+#define TRACE_BATCH 4096
+
+/* A batch of parsed accesses in structure of arrays form. It is only
+ * read while simulating, so many configurations can share it. writes
+ * counts the set entries of write[], core[] is only used by multi-core
+ * simulations.
+ */
+typedef struct access_batch_t {
+  size_t len;
+  size_t writes;
+  uint64_t address[TRACE_BATCH];
+  uint8_t type[TRACE_BATCH];
+  uint8_t write[TRACE_BATCH];
+  uint8_t core[TRACE_BATCH];
+} access_batch_t;
+
+/* Tag and index of a batch, decoded for one configuration in one tight
+ * loop. Byte offsets do not affect hits and are not decoded.
+ */
+typedef struct access_ids_t {
+  uint64_t tag[TRACE_BATCH];
+  uint32_t index[TRACE_BATCH];
+} access_ids_t;
+
+/* Traffic to the next level in bytes: read_bytes is filled blocks,
+ * write_bytes is written back blocks and written through stores
+ */
 typedef struct cache_stat_t {
   uint64_t accesses;
   uint64_t hits;
   uint64_t evicts;
+  uint64_t writes;
+  uint64_t writebacks;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+  /* useful: prefetched blocks later used, useless: dropped unused,
+   * prefetch_evicts: blocks evicted by prefetches, pollution_misses:
+   * demand misses on blocks a prefetch evicted
+   */
+  uint64_t prefetches;
+  uint64_t useful_prefetches;
+  uint64_t useless_prefetches;
+  uint64_t prefetch_evicts;
+  uint64_t pollution_misses;
+  /* 3C classification of the misses: compulsory: first access to the
+   * block, conflict: a fully associative LRU cache of the same size hits,
+   * capacity: it misses as well. victim_hits: misses served by the victim
+   * cache, counted as hits.
+   */
+  uint64_t compulsory_misses;
+  uint64_t capacity_misses;
+  uint64_t conflict_misses;
+  uint64_t victim_hits;
 } cache_stat_t;
 
-int countBits(uint8_t n);
+/* LRU stack distance analysis. Every line marks the time of its last
+ * access in a Fenwick tree, so the number of distinct lines touched
+ * since then is a prefix sum. Times are renumbered when the tree fills.
+ */
+#define STACK_DIST_MIN_CAPACITY (1U << 20)
+
+typedef struct stack_dist_t {
+  uint32_t *tree;
+  uint32_t capacity;
+  uint32_t now;
+  uint32_t active;
+  /* line + 1 -> time of last access, open addressing, 0 key is empty */
+  uint64_t *keys;
+  uint32_t *times;
+  size_t map_size;
+  /* hist[0]: distance 0, hist[k]: distances [2^(k-1), 2^k) */
+  uint64_t hist[34];
+  uint64_t accesses;
+  uint64_t cold;
+} stack_dist_t;
+
+/* Distance of first accesses */
+#define STACK_DIST_COLD UINT32_MAX
+
+/* SHARDS miss ratio curves: only lines whose hash modulo SHARDS_MODULUS
+ * is below threshold are sampled, their stack distances are scaled up by
+ * the inverse sampling rate. At most max_lines are tracked, a max-heap
+ * of their hashes finds the lines to drop when the threshold is lowered
+ * to keep it so, so memory is constant whatever the footprint.
+ */
+#define SHARDS_MODULUS (1U << 24)
+#define SHARDS_DEFAULT_LINES (1U << 15)
+
+typedef struct shards_entry_t {
+  uint64_t line;
+  uint32_t hash;
+} shards_entry_t;
+
+/* hist is like the one of stack_dist_t, but every sampled access weighs
+ * the inverse of the sampling rate it was sampled at. weight sums them
+ * over all sampled accesses.
+ */
+typedef struct shards_t {
+  stack_dist_t sd;
+  uint32_t threshold;
+  uint32_t max_lines;
+  shards_entry_t *heap;
+  uint32_t heap_len;
+  uint64_t accesses;
+  double hist[64];
+  double weight;
+} shards_t;
+
+/* Inclusion between the levels of a hierarchy:
+ *  nine:      non-inclusive non-exclusive, every level that missed is filled
+ *  inclusive: as nine, and a block evicted from a lower level is invalidated
+ *             in the levels above it
+ *  exclusive: only the first level is filled, lower levels hold the victims
+ *             of the level above them
+ */
+typedef enum { nine, inclusive, exclusive } inclusion_t;
+
+/* Geometry of one simulated cache, assoc is only used for set associative */
+typedef struct cache_config_t {
+  uint32_t size;
+  cache_map_t mapping;
+  cache_org_t org;
+  uint32_t assoc;
+  cache_policy_t policy;
+  write_policy_t write;
+  uint32_t block;
+  prefetch_t prefetch;
+  /* Blocks of the victim cache, 0 for none */
+  uint32_t victim;
+  bool classify;
+  /* Simulate about 1 in sample sets, 0 or 1 simulates all */
+  uint32_t sample;
+} cache_config_t;
+
+/* Prefetcher parameters */
+#define PREFETCH_DEGREE 2
+#define STRIDE_TABLE_SIZE 64
+#define STRIDE_REGION_BITS 12
+#define STREAM_BUFFERS 4
+#define STREAM_DEPTH 4
+#define POLLUTION_FILTER_SIZE 4096
+
+/* Last block and stride seen in a region, region + 1 so 0 is empty */
+typedef struct stride_entry_t {
+  uint64_t region;
+  uint64_t last;
+  int64_t stride;
+  uint32_t confidence;
+} stride_entry_t;
+
+/* Sequential blocks head to head + count - 1 waiting in a stream buffer */
+typedef struct stream_buffer_t {
+  uint64_t head;
+  uint32_t count;
+  uint64_t used;
+} stream_buffer_t;
+
+/* Prefetcher of one cache. prefetched marks the blocks a prefetch filled
+ * that were not used yet, filter holds blocks + 1 evicted by prefetches.
+ */
+typedef struct prefetcher_t {
+  prefetch_t kind;
+  uint64_t *prefetched;
+  uint64_t *filter;
+  stride_entry_t stride[STRIDE_TABLE_SIZE];
+  stream_buffer_t stream[STREAM_BUFFERS];
+  uint64_t clock;
+} prefetcher_t;
+
+#define VICTIM_MAX_BLOCKS 64
+
+/* Fully associative LRU buffer of the blocks evicted from a cache, block
+ * + 1 so 0 is empty. A miss found here swaps the block with the victim of
+ * its fill. Entries are clean, dirty blocks are written back as they
+ * leave the cache.
+ */
+typedef struct victim_cache_t {
+  uint64_t block[VICTIM_MAX_BLOCKS];
+  uint64_t used[VICTIM_MAX_BLOCKS];
+  uint32_t blocks;
+  uint64_t clock;
+} victim_cache_t;
+
+#define SEEN_MIN_SIZE (1U << 16)
+#define SEEN_LOOKAHEAD 8
+
+/* Block + 1 of a block seen before, 0 is empty, and the shadow way + 1
+ * holding it or 0
+ */
+typedef struct seen_entry_t {
+  uint64_t key;
+  uint32_t way;
+} seen_entry_t;
+
+/* 3C miss classifier of one cache, a fully associative LRU shadow cache of
+ * as many blocks and the set of blocks seen so far in one open addressing
+ * map. The shadow keeps the map slot of every way and a circular recency
+ * list of ways, head is the most recent.
+ */
+typedef struct miss_classifier_t {
+  seen_entry_t *seen;
+  size_t map_size;
+  size_t count;
+  uint32_t length;
+  uint32_t filled;
+  uint32_t head;
+  size_t *slot;
+  uint32_t *prev;
+  uint32_t *next;
+  bool write_allocate;
+} miss_classifier_t;
+
+struct cache_sim_t;
+
+/* Set sampling: only sets with a group simulate their accesses, about 1
+ * in rate by a hash of the set index. The sampled sets are dealt into
+ * SAMPLE_GROUPS groups in index order, each simulated from its own batch
+ * with the configuration's kernel, so the spread of the group hit rates
+ * bounds the error of the extrapolated hit rate.
+ */
+#define SAMPLE_GROUPS 16
+
+typedef struct set_sampler_t {
+  uint32_t rate;
+  uint32_t sets;
+  uint32_t sampled;
+  /* Group + 1 of every set, 0 if it is not sampled */
+  uint8_t *group;
+  access_batch_t *batch;
+  uint64_t (*kernel)(struct cache_sim_t *sim, const access_batch_t *batch);
+  uint64_t accesses[SAMPLE_GROUPS];
+  uint64_t hits[SAMPLE_GROUPS];
+} set_sampler_t;
+
+/* Batches of accesses a partition can queue per round */
+#define PARTITION_QUEUE 16
+
+struct partition_pool_t;
+
+/* Set partitioned simulation of a configuration: a view of it simulates
+ * the accesses to its range of sets. The reader routes them to one queue
+ * while the view simulates the other, queued counts the accesses in each.
+ */
+typedef struct partition_t {
+  access_batch_t *queue[2];
+  size_t queued[2];
+  struct partition_pool_t *pool;
+} partition_t;
+
+/* One simulated cache configuration and its statistics. cache[] is
+ * indexed by access type, a unified cache only uses cache[0] and both
+ * entries of caches[] point to it. kernel simulates a batch and returns
+ * its hits, it is specialized for the configuration by cache_sim_init().
+ */
+typedef struct cache_sim_t {
+  cache_config_t config;
+  uint32_t length;
+  uint32_t ways;
+  cache_bits_t bits;
+  cache_t cache[2];
+  cache_t *caches[2];
+  access_ids_t *ids;
+  /* Indexed like cache[], NULL when not configured */
+  prefetcher_t *prefetcher;
+  victim_cache_t *victim_cache;
+  miss_classifier_t *classifier;
+  /* NULL unless sampling, statistics are then extrapolated */
+  set_sampler_t *sampler;
+  /* NULL unless this is a view of a set partitioned simulation */
+  partition_t *partition;
+  cache_stat_t stats;
+  uint64_t (*kernel)(struct cache_sim_t *sim, const access_batch_t *batch);
+  /* Checkpoint the caches were restored from, NULL if none */
+  void *snapshot;
+  size_t snapshot_size;
+} cache_sim_t;
+
+/* Checkpoint of the caches of a simulation: the header, then for every
+ * cache its checkpoint_cache_t and its arrays, each starting on a
+ * CHECKPOINT_ALIGN boundary so they are used in place once mapped. The
+ * structures are stored as laid out in memory, a checkpoint is only read
+ * back by the build that wrote it.
+ */
+#define CHECKPOINT_MAGIC "CSIMCKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGN 64
+#define CHECKPOINT_ARRAYS 9
+
+typedef struct checkpoint_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t caches;
+  cache_config_t config;
+  cache_stat_t stats;
+  /* Trace records simulated before the checkpoint */
+  uint64_t offset;
+} checkpoint_header_t;
+
+/* Counters and policy state of one cache, tag_hi tells whether the high
+ * tag bits are stored
+ */
+typedef struct checkpoint_cache_t {
+  uint32_t tag_hi;
+  uint64_t rng;
+  uint64_t victim;
+  uint64_t writebacks;
+  uint64_t write_around;
+  uint64_t evicts;
+} checkpoint_cache_t;
+
+#define MAX_LEVELS 4
+
+/* Cache hierarchy, level[0] is closest to the core. Latencies are the hit
+ * latencies in cycles of every level and of memory.
+ */
+typedef struct hierarchy_t {
+  uint32_t levels;
+  cache_sim_t level[MAX_LEVELS];
+  uint32_t latency[MAX_LEVELS];
+  uint32_t memory_latency;
+  inclusion_t inclusion;
+  uint64_t memory_accesses;
+} hierarchy_t;
+
+/* Coherence protocols of the private caches of a multi-core simulation */
+typedef enum { msi, mesi, moesi } protocol_t;
+
+/* Coherence state of every block of a private cache. A block invalidated
+ * by another cache keeps its tag as st_invalidated until its way is
+ * refilled, a miss on it is a coherence miss.
+ */
+typedef enum {
+  st_invalid, st_invalidated, st_shared, st_exclusive, st_owned, st_modified
+} block_state_t;
+
+/* Private caches of all cores are bits of a 64 bit holder mask */
+#define MAX_COHERENT_CACHES 64
+
+/* Directory entry of a cached block, key is block + 1 so 0 is empty */
+typedef struct dir_entry_t {
+  uint64_t key;
+  uint64_t holders;
+} dir_entry_t;
+
+/* A core and its private caches, state[] is indexed like cache[] of sim.
+ * invalidations counts the blocks other caches invalidated in them.
+ */
+typedef struct coherence_core_t {
+  cache_sim_t sim;
+  uint8_t *state[2];
+  uint64_t coherence_misses;
+  uint64_t invalidations;
+} coherence_core_t;
+
+/* Private caches of cores kept coherent by a directory. It holds a mask
+ * of the caches holding every cached block, so no cache is snooped that
+ * does not hold the block. Cache i of core c is bit c * caches + i.
+ * Bus transactions:
+ *  bus_reads:           read misses (BusRd)
+ *  bus_read_exclusives: write misses (BusRdX)
+ *  bus_upgrades:        writes to shared or owned blocks (BusUpgr)
+ *  writebacks:          dirty blocks written to memory, when evicted and
+ *                       when a read shares a modified block (MSI, MESI)
+ * transfers counts misses served by the cache holding the block dirty.
+ */
+typedef struct coherence_t {
+  protocol_t protocol;
+  uint32_t cores;
+  uint32_t caches;
+  coherence_core_t *core;
+  dir_entry_t *dir;
+  size_t dir_size;
+  uint64_t bus_reads;
+  uint64_t bus_read_exclusives;
+  uint64_t bus_upgrades;
+  uint64_t writebacks;
+  uint64_t transfers;
+} coherence_t;
+
+int countBits(uint32_t n);
 
 bool is_power_of_two(uint32_t n);
 
 int verify_cache_size(uint32_t cache_size);
 
-uint32_t get_cache_length(uint32_t cache_size, cache_org_t cache_org);
+int verify_block_size(uint32_t block_size);
+
+uint32_t parse_cache_size(const char *arg);
+
+uint32_t get_cache_length(uint32_t cache_size, cache_org_t cache_org, uint32_t block_size);
+
+uint32_t get_cache_ways(uint32_t cache_length, cache_map_t cache_mapping, uint32_t assoc);
+
+void set_cache_bits(cache_bits_t *cache_bits,
+                  uint32_t cache_length,
+                  uint32_t cache_ways,
+                  cache_map_t cache_mapping,
+                  cache_org_t cache_org,
+                  uint32_t block_size);
+
+int cache_init(cache_t *cache, uint32_t length, uint32_t ways, cache_policy_t policy);
+
+void cache_deinit(cache_t *cache);
+
+int cache_set_write_policy(cache_t *cache, write_policy_t write);
+
+void set_access_identifiers(mem_access_t *access, cache_bits_t cache_bits);
+
+void set_access_identifiers_batch(const access_batch_t *batch,
+                                  cache_bits_t cache_bits,
+                                  access_ids_t *ids);
+
+uint64_t access_cache_batch(cache_t *const caches[2],
+                            cache_map_t cache_mapping,
+                            const access_batch_t *batch,
+                            const access_ids_t *ids);
+
+int access_cache_dm(cache_t *cache, const mem_access_t *access);
+
+int access_cache_fa(cache_t *cache, const mem_access_t *access);
+
+int access_cache_sa(cache_t *cache, const mem_access_t *access);
+
+int cache_lookup(const cache_t *cache, uint32_t index, uint64_t tag);
+
+int is_address_in_fa_cache(const cache_t *cache, const mem_access_t *access);
+
+void transfer_address_to_cache(cache_t *cache, const mem_access_t *access);
+
+int cache_fill(cache_t *cache, uint32_t index, uint64_t tag);
+
+int cache_invalidate(cache_t *cache, uint32_t index, uint64_t tag);
+
+int read_transaction(trace_t *trace, mem_access_t *access);
+
+int trace_open(trace_t *trace, const char *path);
+
+int trace_read(trace_t *trace, mem_access_t *access);
+
+size_t trace_read_batch(trace_t *trace, access_batch_t *batch);
+
+uint64_t trace_skip(trace_t *trace, uint64_t n);
+
+void trace_close(trace_t *trace);
+
+int trace_convert(const char *in_path, const char *out_path, trace_enc_t encoding);
+
+int parse_cache_config(cache_config_t *config, const char *size,
+                       const char *mapping, const char *org, uint32_t assoc);
+
+int parse_cache_policy(cache_policy_t *policy, const char *name);
+
+int parse_write_policy(write_policy_t *write, const char *name);
+
+int parse_prefetcher(prefetch_t *prefetch, const char *name);
+
+int cache_sim_init(cache_sim_t *sim, const cache_config_t *config);
+
+void cache_sim_deinit(cache_sim_t *sim);
+
+void cache_sim_run_batch(cache_sim_t *sim, const access_batch_t *batch);
+
+double cache_sim_hit_rate_ci(const cache_sim_t *sim);
+
+int cache_sim_run_trace(cache_sim_t *sim, trace_t *trace, uint32_t threads);
+
+int cache_sim_save(const cache_sim_t *sim, const char *path);
+
+int cache_sim_restore(cache_sim_t *sim, const char *path, uint64_t *offset);
+
+int run_sweep(const char *config_path, const char *trace_path, uint32_t threads);
+
+int hierarchy_init(hierarchy_t *hierarchy, const char *config_path);
+
+void hierarchy_deinit(hierarchy_t *hierarchy);
+
+void hierarchy_access(hierarchy_t *hierarchy, uint64_t address, access_t type);
+
+double hierarchy_amat(const hierarchy_t *hierarchy);
+
+int run_hierarchy(const char *config_path, const char *trace_path);
+
+int coherence_init(coherence_t *coh, const char *config_path, uint32_t cores);
+
+void coherence_deinit(coherence_t *coh);
+
+void coherence_access(coherence_t *coh, uint32_t core, uint64_t address,
+                      access_t type, bool write);
+
+int run_coherence(const char *config_path, const char *const *trace_paths, uint32_t count);
+
+int stack_dist_init(stack_dist_t *sd);
+
+void stack_dist_deinit(stack_dist_t *sd);
+
+uint32_t stack_dist_access(stack_dist_t *sd, uint64_t line);
+
+uint64_t stack_dist_hits(const stack_dist_t *sd, uint32_t blocks);
+
+int run_stack_distance(const char *trace_path, cache_org_t cache_org, uint32_t block_size);
+
+int shards_init(shards_t *sh, uint32_t max_lines);
+
+void shards_deinit(shards_t *sh);
+
+void shards_access(shards_t *sh, uint64_t line);
+
+double shards_miss_ratio(const shards_t *sh, uint64_t blocks);
+
+int run_mrc(const char *trace_path, cache_org_t cache_org, uint32_t block_size,
+            uint32_t max_lines);
+
+// #endif
+
+cache_stat_t cache_statistics;
+
+/* Supported cache sizes in bytes, up to last level cache sizes */
+#define MIN_CACHE_SIZE 128
+#define MAX_CACHE_SIZE (64U << 20)
+
+/* Addresses are 64 bits wide. Stored tags keep TAG_BITS of them, enough
+ * for 48 bit virtual and 52 bit physical addresses at any geometry.
+ */
+#define ADDRESS_BITS 64
+#define TAG_BITS 48
+
+/* Supported block sizes in bytes */
+#define DEFAULT_BLOCK_SIZE 64
+#define MIN_BLOCK_SIZE 16
+#define MAX_BLOCK_SIZE 256
+
+/* Text traces are read in blocks of TRACE_BUF_SIZE bytes, a record is
+ * assumed to fit in TRACE_LINE_MAX bytes
+ */
+#define TRACE_BUF_SIZE (1 << 20)
+#define TRACE_LINE_MAX 256
+
+#define TRACE_MAGIC "CSIMTRC"
+#define TRACE_VERSION 2
+
+/* Sets with at least this many ways get a hashed tag index, below it
+ * a (vectorized) scan over the ways is cheaper
+ */
+#define TAG_INDEX_MIN_WAYS 512
+
+/* Sets with at least this many ways compare tags with SIMD kernels */
+#define SIMD_MIN_WAYS 4
+
+/* Bytes a written through store sends to the next level, traces carry
+ * no access sizes
+ */
+#define WRITE_THROUGH_BYTES 4
+
+static void print_cache_hit(const mem_access_t *access);
+static void print_cache_miss(const mem_access_t *access);
+
+static void print_cache_hit(const mem_access_t *access)
+{
+  printf("0x%" PRIx64 " - Cache hit\n", access->address);
+}
+
+static void print_cache_miss(const mem_access_t *access)
+{
+  printf("0x%" PRIx64 " - Cache miss\n", access->address);
+}
+
+/* Value + 1 of every hexadecimal digit, 0 for any other character */
+static const uint8_t hex_digit[256] = {
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+  ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static inline bool is_space(uint8_t c)
+{
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* Compressed traces, recognised by their magic and decompressed by the
+ * tool running as a child process
+ */
+static const struct {
+  const char *tool;
+  uint8_t magic[6];
+  size_t len;
+} decompressors[] = {
+  { "gzip", { 0x1f, 0x8b }, 2 },
+  { "zstd", { 0x28, 0xb5, 0x2f, 0xfd }, 4 },
+  { "xz", { 0xfd, '7', 'z', 'X', 'Z', 0x00 }, 6 },
+  { "bzip2", { 'B', 'Z', 'h' }, 3 },
+};
+
+/* Reads until len bytes or the end of the input, returns how many */
+static size_t read_full(int fd, uint8_t *buf, size_t len)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = read(fd, buf + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+static int write_full(int fd, const uint8_t *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Feeder thread, copies the bytes read to recognise the compression and
+ * then the rest of the compressed input into the decompressor. SIGPIPE
+ * is blocked on this thread only, a decompressor exiting early makes the
+ * writes fail with EPIPE and the feeder stop.
+ */
+static void *trace_feed(void *arg)
+{
+  trace_t *trace = arg;
+  uint8_t buf[1 << 16];
+  sigset_t pipe_signal;
+  bool ok;
+  size_t n;
+
+  sigemptyset(&pipe_signal);
+  sigaddset(&pipe_signal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+
+  ok = (write_full(trace->feed_fd, trace->prefix, trace->prefix_len) == 0);
+
+  while (ok && (n = read_full(trace->src_fd, buf, sizeof(buf))) > 0) {
+    ok = (write_full(trace->feed_fd, buf, n) == 0);
+  }
+
+  /* The decompressor finishes once its input is closed */
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  close(trace->feed_fd);
+  trace->feed_fd = -1;
+  return NULL;
+}
+
+/* Starts tool decompressing src_fd, the trace reads its output. Reading
+ * and decompressing overlap with the simulation.
+ */
+static int trace_decompress(trace_t *trace, const char *tool, int src_fd)
+{
+  int in[2], out[2];
+  pid_t pid;
+
+  if (pipe(in)) {
+    return -1;
+  }
+  if (pipe(out)) {
+    close(in[0]);
+    close(in[1]);
+    return -1;
+  }
+  pid = fork();
+  if (pid < 0) {
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    close(src_fd);
+    execlp(tool, tool, "-dc", (char *)NULL);
+    /* stdout is the pipe */
+    fprintf(stderr, "Unable to run %s\n", tool);
+    _exit(127);
+  }
+
+  close(in[0]);
+  close(out[1]);
+  trace->child = pid;
+  trace->fd = out[0];
+  trace->src_fd = src_fd;
+  trace->feed_fd = in[1];
+  if (pthread_create(&trace->feeder, NULL, trace_feed, trace)) {
+    return -1;
+  }
+  trace->feeding = true;
+  return 0;
+}
+
+/* Stops the decompressor and the feeder, returns the decompressor's exit
+ * status
+ */
+static int trace_reap(trace_t *trace)
+{
+  int status = 0;
+
+  if (trace->feeding) {
+    /* The feeder may wait for input that is no longer needed */
+    pthread_cancel(trace->feeder);
+    pthread_join(trace->feeder, NULL);
+    trace->feeding = false;
+  }
+  if (trace->feed_fd >= 0) {
+    close(trace->feed_fd);
+    trace->feed_fd = -1;
+  }
+  if (trace->child > 0) {
+    waitpid(trace->child, &status, 0);
+    trace->child = 0;
+  }
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+/* At the end of a decompressor's output, it must have succeeded */
+static void trace_end(trace_t *trace)
+{
+  trace->eof = true;
+  if (trace->child > 0 && trace_reap(trace)) {
+    printf("Failed to decompress the trace\n");
+    exit(1);
+  }
+}
+
+/* Moves the unread tail to the front of the buffer and tops it up */
+static void trace_fill(trace_t *trace)
+{
+  size_t tail = trace->buf_len - trace->buf_pos;
+
+  memmove(trace->buf, trace->buf + trace->buf_pos, tail);
+  trace->buf_len = tail;
+  trace->buf_pos = 0;
+
+  while (trace->buf_len < TRACE_BUF_SIZE && !trace->eof) {
+    ssize_t n = read(trace->fd, trace->buf + trace->buf_len,
+                     TRACE_BUF_SIZE - trace->buf_len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      trace_end(trace);
+    } else {
+      trace->buf_len += n;
+    }
+  }
+}
+
+static void skip_space(trace_t *trace)
+{
+  while (1) {
+    while (trace->buf_pos < trace->buf_len && is_space(trace->buf[trace->buf_pos])) {
+      trace->buf_pos++;
+    }
+    if (trace->buf_pos < trace->buf_len || trace->eof) {
+      return;
+    }
+    trace_fill(trace);
+  }
+}
+
+/* Reads a memory access from the trace file into
+ * 1) access type (instruction or data access
+ * 2) memory address
+ * Each record is a type character, blanks and a hexadecimal address.
+ * Types are I (instruction), D or R (data read) and W (data write).
+ * Records of multi-core traces end in blanks and the decimal core.
+ * Returns 1 if a record was read, 0 at the end of the trace.
+ */
+int read_transaction(trace_t *trace, mem_access_t *access) {
+  const uint8_t *p;
+  const uint8_t *end;
+  const uint8_t *digits;
+  uint64_t address = 0;
+  uint8_t type;
+
+  skip_space(trace);
+  if (trace->buf_len - trace->buf_pos < TRACE_LINE_MAX && !trace->eof) {
+    trace_fill(trace);
+  }
+
+  p = trace->buf + trace->buf_pos;
+  end = trace->buf + trace->buf_len;
+
+  if (p == end) {
+    /* No more entries in the file */
+    return 0;
+  }
+
+  type = *p++;
+  if (type != 'I' && type != 'D' && type != 'R' && type != 'W') {
+    printf("Unkown access type\n");
+    exit(0);
+  }
+
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && hex_digit[p[2]]) {
+    p += 2;
+  }
+
+  digits = p;
+  while (p < end && hex_digit[*p]) {
+    address = (address << 4) | (hex_digit[*p] - 1);
+    p++;
+  }
+  if (p == digits) {
+    printf("Malformed trace record, expected an address\n");
+    exit(0);
+  }
+  /* More digits would wrap around to a different address */
+  if (p - digits > ADDRESS_BITS / 4) {
+    printf("Malformed trace record, address wider than %u bits\n", ADDRESS_BITS);
+    exit(0);
+  }
+
+  /* Records start with a type, so a number after the address is a core */
+  access->core = 0;
+  if (p < end && (*p == ' ' || *p == '\t')) {
+    const uint8_t *q = p;
+    uint32_t core = 0;
+
+    while (q < end && (*q == ' ' || *q == '\t')) {
+      q++;
+    }
+    if (q < end && *q >= '0' && *q <= '9') {
+      while (q < end && *q >= '0' && *q <= '9') {
+        core = core * 10 + (*q++ - '0');
+        if (core >= MAX_COHERENT_CACHES) {
+          printf("Malformed trace record, core out of range\n");
+          exit(0);
+        }
+      }
+      access->core = core;
+      p = q;
+    }
+  }
+  trace->buf_pos = p - trace->buf;
+
+  access->address = address;
+  access->accesstype = (type == 'I') ? instruction : data;
+  access->write = (type == 'W');
+  return 1;
+}
+
+/* Cache size in bytes, optionally with a K or M suffix (e.g. 32K, 8M) */
+uint32_t parse_cache_size(const char *arg)
+{
+  char *suffix;
+  unsigned long size = strtoul(arg, &suffix, 10);
+
+  if (*suffix == 'K' || *suffix == 'k') {
+    size <<= 10;
+  } else if (*suffix == 'M' || *suffix == 'm') {
+    size <<= 20;
+  }
+
+  /* Out of range sizes are rejected by verify_cache_size() */
+  return (size > UINT32_MAX) ? 0 : (uint32_t)size;
+}
+
+static int read_binary_transaction(trace_t *trace, mem_access_t *access)
+{
+  uint64_t record;
+
+  if (trace->pos == trace->count) {
+    /* End of trace */
+    return 0;
+  }
+
+  switch (trace->encoding) {
+  case enc_fixed32:
+    access->address = ((const uint32_t *)trace->cursor)[trace->pos];
+    access->accesstype = (trace->types[trace->pos >> 3] >> (trace->pos & 7)) & 1;
+    access->write = trace->writes &&
+                    ((trace->writes[trace->pos >> 3] >> (trace->pos & 7)) & 1);
+    break;
+  case enc_fixed64:
+    record = ((const uint64_t *)trace->cursor)[trace->pos];
+    access->address = record >> trace->flag_bits;
+    access->accesstype = record & 1;
+    access->write = (trace->flag_bits == 2) && ((record >> 1) & 1);
+    break;
+  default: { /* enc_delta */
+    uint64_t zigzag;
+    int shift = 0;
+    const uint8_t *end = trace->map + trace->map_size;
+
+    record = 0;
+    do {
+      if (trace->cursor == end || shift > 63) {
+        printf("Truncated binary trace\n");
+        exit(1);
+      }
+      record |= (uint64_t)(*trace->cursor & 0x7f) << shift;
+      shift += 7;
+    } while (*trace->cursor++ & 0x80);
+
+    zigzag = record >> trace->flag_bits;
+    trace->prev += (zigzag >> 1) ^ -(zigzag & 1);
+    access->address = trace->prev;
+    access->accesstype = record & 1;
+    access->write = (trace->flag_bits == 2) && ((record >> 1) & 1);
+    break;
+  }
+  }
+
+  /* Binary traces are single core */
+  access->core = 0;
+  trace->pos++;
+  return 1;
+}
+
+/* Checks the header of a binary trace in map and points the trace at its
+ * records
+ */
+static int trace_init_binary(trace_t *trace)
+{
+  trace_header_t header;
+
+  memcpy(&header, trace->map, sizeof(header));
+  if (header.version < 1 || header.version > TRACE_VERSION || header.encoding > enc_delta) {
+    printf("Unsupported binary trace version or encoding\n");
+    return -1;
+  }
+
+  trace->flag_bits = (header.version >= 2) ? 2 : 1;
+
+  /* Fixed size records must all be inside the file. The count is checked
+   * by division first, so the sizes below cannot overflow.
+   */
+  size_t payload = trace->map_size - sizeof(trace_header_t);
+  if ((header.encoding == enc_fixed32
+       && (header.count > payload / sizeof(uint32_t)
+           || payload - header.count * sizeof(uint32_t)
+              < trace->flag_bits * ((header.count + 7) / 8)))
+      || (header.encoding == enc_fixed64
+       && header.count > payload / sizeof(uint64_t))) {
+    printf("Truncated binary trace\n");
+    return -1;
+  }
+
+  trace->encoding = header.encoding;
+  trace->count = header.count;
+  trace->cursor = trace->map + sizeof(trace_header_t);
+  if (header.encoding == enc_fixed32) {
+    trace->types = trace->cursor + header.count * sizeof(uint32_t);
+    if (header.version >= 2) {
+      trace->writes = trace->types + (header.count + 7) / 8;
+    }
+  }
+
+  return 0;
+}
+
+/* Reads the rest of a binary trace stream into memory after the buffered
+ * start, it is used like a mapped file afterwards
+ */
+static int trace_read_binary_stream(trace_t *trace)
+{
+  size_t size = trace->buf_len;
+  size_t capacity = 4 * (size_t)TRACE_BUF_SIZE;
+  uint8_t *data = malloc(capacity);
+
+  if (!data) {
+    return -1;
+  }
+  memcpy(data, trace->buf, size);
+
+  while (!trace->eof) {
+    if (size == capacity) {
+      uint8_t *grown = realloc(data, 2 * capacity);
+      if (!grown) {
+        free(data);
+        return -1;
+      }
+      data = grown;
+      capacity *= 2;
+    }
+    size_t n = read_full(trace->fd, data + size, capacity - size);
+    if (n < capacity - size) {
+      trace_end(trace);
+    }
+    size += n;
+  }
+
+  free(trace->buf);
+  trace->buf = NULL;
+  trace->buf_len = 0;
+  trace->map = data;
+  trace->map_size = size;
+  trace->map_owned = true;
+  return 0;
+}
+
+/* Opens a trace, "-" reads it from stdin. Binary trace files are
+ * recognised by their magic and mapped into memory, gzip, zstd, xz and
+ * bzip2 compressed traces are decompressed while they are read, anything
+ * else is read as text.
+ */
+int trace_open(trace_t *trace, const char *path)
+{
+  trace_header_t header;
+  struct stat st;
+  size_t n;
+  int fd;
+
+  memset(trace, 0, sizeof(trace_t));
+
+  trace->fd = -1;
+  trace->src_fd = -1;
+  trace->feed_fd = -1;
+
+  fd = (strcmp(path, "-") == 0) ? dup(STDIN_FILENO) : open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+      && (size_t)st.st_size >= sizeof(trace_header_t)
+      && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+      && memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0) {
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace->map == MAP_FAILED) {
+      trace->map = NULL;
+      return -1;
+    }
+    madvise((void *)trace->map, trace->map_size, MADV_SEQUENTIAL);
+    if (trace_init_binary(trace)) {
+      trace_close(trace);
+      return -1;
+    }
+    return 0;
+  }
+
+  /* Anything else is streamed, its first bytes tell the compression */
+  trace->buf = malloc(TRACE_BUF_SIZE);
+  if (!trace->buf) {
+    close(fd);
+    return -1;
+  }
+  trace->fd = fd;
+  n = read_full(fd, trace->buf, sizeof(trace->prefix));
+  trace->buf_len = n;
+  for (size_t i = 0; i < sizeof(decompressors) / sizeof(decompressors[0]); i++) {
+    if (n >= decompressors[i].len &&
+        memcmp(trace->buf, decompressors[i].magic, decompressors[i].len) == 0) {
+      memcpy(trace->prefix, trace->buf, n);
+      trace->prefix_len = n;
+      trace->buf_len = 0;
+      trace->fd = -1;
+      if (trace_decompress(trace, decompressors[i].tool, fd)) {
+        printf("Failed to start %s to decompress the trace\n", decompressors[i].tool);
+        trace->src_fd = fd;
+        trace_close(trace);
+        return -1;
+      }
+      break;
+    }
+  }
+  if (n < sizeof(trace->prefix)) {
+    trace->eof = (trace->child == 0);
+  }
+  trace_fill(trace);
+
+  /* A binary trace from a pipe or decompressor */
+  if (trace->buf_len >= sizeof(trace_header_t) &&
+      memcmp(trace->buf, TRACE_MAGIC, sizeof(header.magic)) == 0) {
+    if (trace_read_binary_stream(trace) || trace_init_binary(trace)) {
+      trace_close(trace);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Returns 1 if a record was read, 0 at the end of the trace */
+int trace_read(trace_t *trace, mem_access_t *access)
+{
+  int ret;
+
+  if (trace->limit && trace->records >= trace->limit) {
+    return 0;
+  }
+  if (trace->map) {
+    ret = read_binary_transaction(trace, access);
+  } else {
+    ret = read_transaction(trace, access);
+  }
+  trace->records += ret;
+  return ret;
+}
+
+/* Fills a batch with up to TRACE_BATCH records, returns how many were read,
+ * 0 at the end of the trace
+ */
+size_t trace_read_batch(trace_t *trace, access_batch_t *batch)
+{
+  mem_access_t access;
+  size_t n = 0;
+  size_t max = TRACE_BATCH;
+  size_t writes = 0;
+
+  if (trace->limit) {
+    max = (trace->limit <= trace->records) ? 0 :
+          (trace->limit - trace->records < TRACE_BATCH) ? trace->limit - trace->records :
+          TRACE_BATCH;
+  }
+
+  if (trace->map) {
+    while (n < max && read_binary_transaction(trace, &access)) {
+      batch->address[n] = access.address;
+      batch->type[n] = access.accesstype;
+      batch->write[n] = access.write;
+      batch->core[n] = access.core;
+      writes += access.write;
+      n++;
+    }
+  } else {
+    while (n < max && read_transaction(trace, &access)) {
+      batch->address[n] = access.address;
+      batch->type[n] = access.accesstype;
+      batch->write[n] = access.write;
+      batch->core[n] = access.core;
+      writes += access.write;
+      n++;
+    }
+  }
+
+  batch->len = n;
+  batch->writes = writes;
+  trace->records += n;
+  return n;
+}
+
+/* Skips up to n records, returns how many were skipped. Fixed size binary
+ * records are skipped without reading them.
+ */
+uint64_t trace_skip(trace_t *trace, uint64_t n)
+{
+  mem_access_t access;
+  uint64_t skipped = 0;
+
+  if (trace->map && trace->encoding != enc_delta) {
+    skipped = (n < trace->count - trace->pos) ? n : trace->count - trace->pos;
+    trace->pos += skipped;
+    trace->records += skipped;
+    return skipped;
+  }
+  while (skipped < n && trace_read(trace, &access)) {
+    skipped++;
+  }
+  return skipped;
+}
+
+void trace_close(trace_t *trace)
+{
+  if (trace->map_owned) {
+    free((void *)trace->map);
+  } else if (trace->map) {
+    munmap((void *)trace->map, trace->map_size);
+  }
+  if (trace->fd >= 0) {
+    close(trace->fd);
+  }
+  /* Once its output is closed the decompressor stops */
+  trace_reap(trace);
+  if (trace->src_fd >= 0) {
+    close(trace->src_fd);
+  }
+  free(trace->buf);
+  memset(trace, 0, sizeof(trace_t));
+  trace->fd = -1;
+  trace->src_fd = -1;
+  trace->feed_fd = -1;
+}
+
+static int write_varint(FILE *out, uint64_t value)
+{
+  uint8_t buf[10];
+  int len = 0;
+
+  do {
+    buf[len] = value & 0x7f;
+    value >>= 7;
+    if (value) {
+      buf[len] |= 0x80;
+    }
+    len++;
+  } while (value);
+
+  return fwrite(buf, 1, len, out) == (size_t)len ? 0 : -1;
+}
+
+/* Converts a text trace into the binary trace format */
+int trace_convert(const char *in_path, const char *out_path, trace_enc_t encoding)
+{
+  trace_header_t header;
+  mem_access_t access;
+  uint8_t *types = NULL;
+  uint8_t *writes = NULL;
+  size_t types_size = 0;
+  uint64_t prev = 0;
+  int err = 0;
+  trace_t in;
+  FILE *out;
+
+  if (trace_open(&in, in_path)) {
+    printf("Unable to open the trace file\n");
+    return -1;
+  }
+  out = fopen(out_path, "wb");
+  if (!out) {
+    printf("Unable to create the binary trace file\n");
+    trace_close(&in);
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.encoding = encoding;
+  fwrite(&header, sizeof(header), 1, out);
+
+  while (!err && trace_read(&in, &access)) {
+    int64_t delta = (int64_t)(access.address - prev);
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+
+    /* Two flag bits go below the address or delta */
+    if ((encoding == enc_fixed32 && access.address > UINT32_MAX)
+        || (encoding == enc_fixed64 && access.address >> 62)
+        || (encoding == enc_delta && zigzag >> 62)) {
+      printf("Address 0x%" PRIx64 " does not fit the %s encoding\n", access.address,
+             (encoding == enc_fixed32) ? "fixed32" : (encoding == enc_fixed64) ? "fixed64" : "delta");
+      err = -1;
+      break;
+    }
+
+    if (encoding == enc_fixed32) {
+      /* Types and writes are appended after all addresses, collect
+       * them until then
+       */
+      if (header.count / 8 >= types_size) {
+        size_t old_size = types_size;
+        uint8_t *grown_types, *grown_writes;
+
+        types_size = old_size ? 2 * old_size : 4096;
+        grown_types = realloc(types, types_size);
+        if (grown_types) {
+          types = grown_types;
+        }
+        grown_writes = realloc(writes, types_size);
+        if (grown_writes) {
+          writes = grown_writes;
+        }
+        if (!grown_types || !grown_writes) {
+          err = -1;
+          break;
+        }
+        memset(types + old_size, 0, types_size - old_size);
+        memset(writes + old_size, 0, types_size - old_size);
+      }
+      types[header.count / 8] |= access.accesstype << (header.count & 7);
+      writes[header.count / 8] |= access.write << (header.count & 7);
+      uint32_t address = (uint32_t)access.address;
+      err = fwrite(&address, sizeof(address), 1, out) == 1 ? 0 : -1;
+    } else if (encoding == enc_fixed64) {
+      uint64_t record = (uint64_t)access.address << 2 | access.write << 1 | access.accesstype;
+      err = fwrite(&record, sizeof(record), 1, out) == 1 ? 0 : -1;
+    } else {
+      err = write_varint(out, zigzag << 2 | access.write << 1 | access.accesstype);
+      prev = access.address;
+    }
+    header.count++;
+  }
+
+  if (!err && encoding == enc_fixed32 && header.count) {
+    size_t bitmap = (header.count + 7) / 8;
+    err = (fwrite(types, 1, bitmap, out) == bitmap &&
+           fwrite(writes, 1, bitmap, out) == bitmap) ? 0 : -1;
+  }
+
+  /* Record count is only known now */
+  if (!err) {
+    rewind(out);
+    err = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+  }
+
+  free(types);
+  free(writes);
+  trace_close(&in);
+  if (fclose(out) || err) {
+    printf("Failed to write the binary trace file\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+bool is_power_of_two(uint32_t n) {
+    return n && !(n & (n - 1));
+}
+
+int verify_cache_size(uint32_t cache_size)
+{
+  if (cache_size < MIN_CACHE_SIZE) {
+    printf("Cache size is too small, minimum of %u bytes\n", MIN_CACHE_SIZE);
+    return -1;
+  } else if (cache_size > MAX_CACHE_SIZE) {
+    printf("Cache size is too large, maximum of %u bytes\n", MAX_CACHE_SIZE);
+    return -1;
+  } else if (!is_power_of_two(cache_size)) {
+    printf("Invalid cache size. It must be a power of 2\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int verify_block_size(uint32_t block_size)
+{
+  if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE
+      || !is_power_of_two(block_size)) {
+    printf("Invalid block size. It must be a power of 2 from %u to %u bytes\n",
+           MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+    return -1;
+  }
+
+  return 0;
+}
+
+int countBits(uint32_t n) {
+  int count = 0;
+
+  while (n > 1) {
+      count++;
+      n >>= 1;
+  }
+
+  return count;
+}
+
+uint32_t get_cache_length(uint32_t cache_size, cache_org_t cache_org, uint32_t block_size)
+{
+  if (cache_org == uc) {
+    /* Unifed cache */
+    return(cache_size / block_size);
+  } else {
+    /* split cache */
+    return(cache_size / block_size / 2);
+  }
+}
+
+/* Number of blocks per set, assoc is only used for set associative caches */
+uint32_t get_cache_ways(uint32_t cache_length, cache_map_t cache_mapping, uint32_t assoc)
+{
+  if (cache_mapping == dm) {
+    return 1;
+  } else if (cache_mapping == fa) {
+    return cache_length;
+  } else {
+    return assoc;
+  }
+}
+
+void set_cache_bits(cache_bits_t *cache_bits,
+                  uint32_t cache_length,
+                  uint32_t cache_ways,
+                  cache_map_t cache_mapping,
+                  cache_org_t cache_org,
+                  uint32_t block_size)
+{
+  cache_bits->offset = countBits(block_size);
+
+  if (cache_mapping == dm) {
+    /* direct mapped */
+    cache_bits->index = countBits(cache_length);
+  } else if (cache_mapping == sa) {
+    /* set associative, one index per set */
+    cache_bits->index = countBits(cache_length / cache_ways);
+  } else {
+    /* fully associative */
+    cache_bits->index = 0;
+  }
+
+  cache_bits->tag = ADDRESS_BITS - cache_bits->offset - cache_bits->index;
+}
+
+static inline uint32_t tag_hash(const cache_t *cache, uint64_t tag)
+{
+  /* Fibonacci hashing, the top bits are the best mixed */
+  return (uint32_t)((tag * 0x9E3779B97F4A7C15ULL) >> 32) >> cache->hash_shift;
+}
+
+/* Full tag of block i */
+static inline uint64_t stored_tag(const cache_t *cache, size_t i)
+{
+  return cache->tag[i] | (cache->tag_hi ? (uint64_t)cache->tag_hi[i] << 32 : 0);
+}
+
+static inline bool tag_matches(const cache_t *cache, size_t i, uint64_t tag)
+{
+  return cache->tag[i] == (uint32_t)tag &&
+         (cache->tag_hi ? cache->tag_hi[i] : 0) == (tag >> 32);
+}
+
+/* Stores the high bits of a tag, allocating tag_hi on first use. Blocks
+ * stored before then all have zero high bits.
+ */
+static void store_tag_hi(cache_t *cache, size_t i, uint64_t tag)
+{
+  if (tag >> TAG_BITS) {
+    printf("Address too large, tags are limited to %u bits\n", TAG_BITS);
+    exit(1);
+  }
+  if (!cache->tag_hi) {
+    cache->tag_hi = (uint16_t *)calloc((size_t)cache->length, sizeof(uint16_t));
+    if (!cache->tag_hi) {
+      printf("cache memory allocation failed\n");
+      exit(1);
+    }
+  }
+  cache->tag_hi[i] = (uint16_t)(tag >> 32);
+}
+
+static inline void store_tag(cache_t *cache, size_t i, uint64_t tag)
+{
+  cache->tag[i] = (uint32_t)tag;
+  if (cache->tag_hi || (tag >> 32)) {
+    store_tag_hi(cache, i, tag);
+  }
+}
+
+static uint32_t *tag_index_set(const cache_t *cache, uint32_t index)
+{
+  return &cache->hash[(size_t)index * cache->hash_size];
+}
+
+static void tag_index_insert(cache_t *cache, uint32_t index, uint32_t way)
+{
+  uint32_t *slot = tag_index_set(cache, index);
+  uint32_t mask = cache->hash_size - 1;
+  uint32_t i = tag_hash(cache, stored_tag(cache, (size_t)index * cache->ways + way));
+
+  while (slot[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  slot[i] = way + 1;
+}
+
+/* Linear probing removal with backward shift, so no tombstones build up */
+static void tag_index_remove(cache_t *cache, uint32_t index, uint32_t way)
+{
+  uint32_t *slot = tag_index_set(cache, index);
+  size_t base = (size_t)index * cache->ways;
+  uint32_t mask = cache->hash_size - 1;
+  uint32_t i = tag_hash(cache, stored_tag(cache, base + way));
+  uint32_t j;
+
+  while (slot[i] != way + 1) {
+    i = (i + 1) & mask;
+  }
+
+  j = i;
+  while (1) {
+    j = (j + 1) & mask;
+    if (slot[j] == 0) {
+      break;
+    }
+    /* Entry at j may only move back to i if i lies between its home and j */
+    uint32_t home = tag_hash(cache, stored_tag(cache, base + slot[j] - 1));
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      slot[i] = slot[j];
+      i = j;
+    }
+  }
+  slot[i] = 0;
+}
+
+/* Tag compare kernels: bit i of the result is set if tags[i] == tag,
+ * n is a multiple of SIMD_MIN_WAYS and at most 64
+ */
+static uint64_t match_tags_scalar(const uint32_t *tags, uint32_t n, uint32_t tag)
+{
+  uint64_t match = 0;
+
+  for (uint32_t i = 0; i < n; i++) {
+    match |= (uint64_t)(tags[i] == tag) << i;
+  }
+  return match;
+}
+
+#if defined(__SSE2__)
+static uint64_t match_tags_sse2(const uint32_t *tags, uint32_t n, uint32_t tag)
+{
+  const __m128i probe = _mm_set1_epi32(tag);
+  uint64_t match = 0;
+
+  for (uint32_t i = 0; i < n; i += 4) {
+    __m128i block = _mm_loadu_si128((const __m128i *)&tags[i]);
+    __m128i eq = _mm_cmpeq_epi32(block, probe);
+    match |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+  }
+  return match;
+}
+
+__attribute__((target("avx2")))
+static uint64_t match_tags_avx2(const uint32_t *tags, uint32_t n, uint32_t tag)
+{
+  const __m256i probe = _mm256_set1_epi32(tag);
+  uint64_t match = 0;
+
+  if (n < 8) {
+    return match_tags_sse2(tags, n, tag);
+  }
+
+  for (uint32_t i = 0; i < n; i += 8) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)&tags[i]);
+    __m256i eq = _mm256_cmpeq_epi32(block, probe);
+    match |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+  }
+  return match;
+}
+#endif
+
+/* Best kernel for the host, picked at runtime by select_match_kernel() */
+static uint64_t (*match_tags)(const uint32_t *, uint32_t, uint32_t) = match_tags_scalar;
+
+/* Drops the ways of match whose high tag bits differ, match_tags only
+ * compares the low 32 bits
+ */
+static inline uint64_t match_tags_hi(const cache_t *cache, size_t base,
+                                     uint64_t match, uint64_t tag)
+{
+  if (!cache->tag_hi) {
+    return (tag >> 32) ? 0 : match;
+  }
+  for (uint64_t m = match; m; m &= m - 1) {
+    uint32_t way = __builtin_ctzll(m);
+    if (cache->tag_hi[base + way] != (tag >> 32)) {
+      match &= ~(1ULL << way);
+    }
+  }
+  return match;
+}
+
+/* The host does not change, every cache shares the first choice */
+static pthread_once_t match_kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_match_kernel(void)
+{
+#if defined(__SSE2__)
+  match_tags = match_tags_sse2;
+  if (__builtin_cpu_supports("avx2")) {
+    match_tags = match_tags_avx2;
+  }
+#endif
+}
+
+int cache_init(cache_t *cache, uint32_t length, uint32_t ways, cache_policy_t policy)
+{
+  /* Each cache block includes:
+   *  1 valid bit
+   *  32 tag bits, 16 more once a tag needs them
+   */
+  cache->tag = (uint32_t *)calloc((size_t)length, sizeof(uint32_t));
+  cache->tag_hi = NULL;
+  cache->valid = (uint64_t *)calloc(((size_t)length + 63) / 64, sizeof(uint64_t));
+
+  if (cache->tag == NULL || cache->valid == NULL) {
+    printf("cache memory allocation failed\n");
+    free(cache->tag);
+    free(cache->valid);
+    return -1;
+  }
+
+  pthread_once(&match_kernel_once, select_match_kernel);
+
+  cache->evicts = 0;
+  cache->map = NULL;
+  cache->map_size = 0;
+  cache->length = length;
+  cache->ways = ways;
+  cache->sets = length / ways;
+
+  /* FIFO ring of every set, used for searching through associative caches */
+  cache->set = (cache_set_t *)calloc((size_t)cache->sets, sizeof(cache_set_t));
+  if (cache->set == NULL) {
+    printf("cache memory allocation failed\n");
+    free(cache->tag);
+    free(cache->valid);
+    return -1;
+  }
+
+  /* Tag index at a load factor of at most 1/2 */
+  cache->hash = NULL;
+  cache->hash_size = 0;
+  cache->hash_shift = 0;
+  if (ways >= TAG_INDEX_MIN_WAYS) {
+    cache->hash_size = 2 * ways;
+    cache->hash_shift = 32 - countBits(cache->hash_size);
+    cache->hash = (uint32_t *)calloc((size_t)cache->sets * cache->hash_size,
+                                     sizeof(uint32_t));
+    if (cache->hash == NULL) {
+      printf("cache memory allocation failed\n");
+      free(cache->set);
+      free(cache->tag);
+      free(cache->valid);
+      return -1;
+    }
+  }
+
+  /* Write-through and read only until cache_set_write_policy() */
+  cache->dirty = NULL;
+  cache->write_allocate = true;
+  cache->writebacks = 0;
+  cache->write_around = 0;
+
+  /* Replacement state */
+  cache->policy = policy;
+  cache->meta = NULL;
+  cache->set_state = NULL;
+  cache->bits = NULL;
+  cache->rng = 0x9E3779B97F4A7C15ULL;
+  if (policy == rp_lru) {
+    cache->meta = (uint32_t *)malloc(2 * (size_t)length * sizeof(uint32_t));
+    cache->set_state = (uint32_t *)malloc((size_t)cache->sets * sizeof(uint32_t));
+    if (cache->set_state) {
+      /* Every recency list starts empty */
+      memset(cache->set_state, 0xff, (size_t)cache->sets * sizeof(uint32_t));
+    }
+  } else if (policy == rp_lfu || policy == rp_srrip) {
+    cache->meta = (uint32_t *)calloc((size_t)length, sizeof(uint32_t));
+  } else if (policy == rp_tree_plru || policy == rp_bit_plru) {
+    cache->bits = (uint64_t *)calloc(((size_t)length + 63) / 64, sizeof(uint64_t));
+    if (policy == rp_bit_plru) {
+      cache->set_state = (uint32_t *)calloc((size_t)cache->sets, sizeof(uint32_t));
+    }
+  }
+  if ((policy == rp_lru && (!cache->meta || !cache->set_state)) ||
+      ((policy == rp_lfu || policy == rp_srrip) && !cache->meta) ||
+      (policy == rp_tree_plru && !cache->bits) ||
+      (policy == rp_bit_plru && (!cache->bits || !cache->set_state))) {
+    printf("cache memory allocation failed\n");
+    cache_deinit(cache);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Frees an array of a cache unless it is mapped from a checkpoint */
+static void cache_free(const cache_t *cache, void *array)
+{
+  if (!cache->map || (const uint8_t *)array < cache->map ||
+      (const uint8_t *)array >= cache->map + cache->map_size) {
+    free(array);
+  }
+}
+
+void cache_deinit(cache_t *cache)
+{
+  cache_free(cache, cache->tag);
+  cache_free(cache, cache->tag_hi);
+  cache_free(cache, cache->valid);
+  cache_free(cache, cache->set);
+  cache_free(cache, cache->hash);
+  cache_free(cache, cache->meta);
+  cache_free(cache, cache->set_state);
+  cache_free(cache, cache->bits);
+  cache_free(cache, cache->dirty);
+
+  cache->tag = NULL;
+  cache->tag_hi = NULL;
+  cache->valid = NULL;
+  cache->set = NULL;
+  cache->hash = NULL;
+  cache->meta = NULL;
+  cache->set_state = NULL;
+  cache->bits = NULL;
+  cache->dirty = NULL;
+  cache->map = NULL;
+  cache->map_size = 0;
+  cache->length = 0;
+  cache->sets = 0;
+  cache->ways = 0;
+  cache->hash_size = 0;
+}
+
+int cache_set_write_policy(cache_t *cache, write_policy_t write)
+{
+  cache_free(cache, cache->dirty);
+  cache->dirty = NULL;
+  cache->write_allocate = (write == wp_wb || write == wp_wt);
+
+  if (write == wp_wb || write == wp_wb_nwa) {
+    cache->dirty = (uint64_t *)calloc(((size_t)cache->length + 63) / 64, sizeof(uint64_t));
+    if (cache->dirty == NULL) {
+      printf("cache memory allocation failed\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void set_access_identifiers(mem_access_t *access, cache_bits_t cache_bits)
+{
+  /* byte offset: mask off lower n bits, n being cache_bits.offset */
+  access->offset = access->address & MASK(cache_bits.offset);
+
+  /* index: shift address to right by cache_bits.offset number of bits, mask off index*/
+  access->index = (access->address >> cache_bits.offset) & MASK(cache_bits.index);
+
+  /* tag: same as was done for index, except now for the tag bits */
+  access->tag = (access->address >>
+    (cache_bits.index + cache_bits.offset)) & MASK(cache_bits.tag);
+
+  // printf("set_access_identifiers 0x%x - idx: %x, tag: %x, offset: %x\n",
+  //   access->address ,access->index, access->tag, access->offset);
+}
+
+static inline bool bit_test(const uint64_t *bits, size_t i)
+{
+  return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void bit_assign(uint64_t *bits, size_t i, bool value)
+{
+  bits[i >> 6] = (bits[i >> 6] & ~(1ULL << (i & 63))) | ((uint64_t)value << (i & 63));
+}
+
+/* Counts a writeback if the block leaving the cache is dirty */
+static inline void writeback_block(cache_t *cache, size_t block)
+{
+  if (cache->dirty && bit_test(cache->dirty, block)) {
+    cache->writebacks++;
+    bit_assign(cache->dirty, block, 0);
+  }
+}
+
+static inline int access_dm(cache_t *cache, uint32_t index, uint64_t tag)
+{
+  /* First check valid bit of index */
+  if (BLOCK_VALID(cache, index)) {
+    /* Valid bit set, so next compare tags */
+    if (tag_matches(cache, index, tag)) {
+      /* Valid bit set and tags match, cache hit! */
+      return 1;
+    } else {
+      /* Tags do not match, cache miss. Overwrite new address to this block, update tag */
+      writeback_block(cache, index);
+      store_tag(cache, index, tag);
+      cache->evicts++;
+      return 0;
+    }
+  } else {
+    /* Valid bit is not set, cache miss. Write address to cache */
+    SET_BLOCK_VALID(cache, index);
+    store_tag(cache, index, tag);
+    return 0;
+  }
+}
+
+int access_cache_dm(cache_t *cache, const mem_access_t * access)
+{
+  return access_dm(cache, access->index, access->tag);
+}
+
+/* Valid bits of n blocks starting at block i, n is at most 64 and
+ * the blocks never straddle two words of the bitmap
+ */
+static inline uint64_t valid_bits(const cache_t *cache, size_t i, uint32_t n)
+{
+  uint64_t bits = cache->valid[i >> 6] >> (i & 63);
+
+  return (n == 64) ? bits : bits & ((1ULL << n) - 1);
+}
+
+/* Returns the way holding tag in set index, or -1 if it is not cached */
+static inline int lookup_way(const cache_t *cache, uint32_t index, uint64_t tag)
+{
+  size_t base = (size_t)index * cache->ways;
+  const uint32_t *block_tag = &cache->tag[base];
+
+  if (cache->hash) {
+    /* Highly associative, probe the tag index instead of every way */
+    const uint32_t *slot = tag_index_set(cache, index);
+    uint32_t mask = cache->hash_size - 1;
+    uint32_t i = tag_hash(cache, tag);
+
+    while (slot[i] != 0) {
+      uint32_t way = slot[i] - 1;
+      if (tag_matches(cache, base + way, tag) && BLOCK_VALID(cache, base + way)) {
+        return way;
+      }
+      i = (i + 1) & mask;
+    }
+    return -1;
+  }
+
+  if (cache->ways < SIMD_MIN_WAYS) {
+    for (uint32_t way = 0; way < cache->ways; way++) {
+      if (tag_matches(cache, base + way, tag) && BLOCK_VALID(cache, base + way)) {
+        return way;
+      }
+    }
+    return -1;
+  }
+
+  /* Compare up to 64 ways at a time against their valid bits */
+  for (uint32_t way = 0; way < cache->ways; way += 64) {
+    uint32_t n = (cache->ways - way < 64) ? cache->ways - way : 64;
+    uint64_t match = match_tags(&block_tag[way], n, (uint32_t)tag) &
+                     valid_bits(cache, base + way, n);
+
+    match = match_tags_hi(cache, base + way, match, tag);
+    if (match) {
+      return way + __builtin_ctzll(match);
+    }
+  }
+
+  return -1;
+}
+
+int cache_lookup(const cache_t *cache, uint32_t index, uint64_t tag)
+{
+  return lookup_way(cache, index, tag);
+}
+
+int is_address_in_fa_cache(const cache_t *cache, const mem_access_t *access)
+{
+  const cache_set_t *set = &cache->set[access->index];
+
+  if (set->start == set->end && !set->is_full) {
+    // print_cache_miss(access);
+    return 0;
+  }
+
+  return lookup_way(cache, access->index, access->tag) >= 0;
+}
+
+/* Places tag in the next block of the FIFO ring of set index */
+static inline uint32_t fill_block(cache_t *cache, uint32_t index, uint64_t tag)
+{
+  cache_set_t *set = &cache->set[index];
+  size_t base = (size_t)index * cache->ways;
+  uint32_t way = set->end;
+
+  /* Check if set is full */
+  if (set->is_full) {
+    /* update start, must evict */
+    set->start = (set->start + 1) & (cache->ways - 1);
+    cache->victim = stored_tag(cache, base + set->end);
+    writeback_block(cache, base + set->end);
+    if (cache->hash) {
+      tag_index_remove(cache, index, set->end);
+    }
+    cache->evicts++;
+  }
+
+  /* Transfer address, ignoring offset bytes for now */
+  SET_BLOCK_VALID(cache, base + set->end);
+  store_tag(cache, base + set->end, tag);
+  if (cache->hash) {
+    tag_index_insert(cache, index, set->end);
+  }
+
+  /* Update end pointer, this will wrap around to the
+  beginning once all ways of the set are used */
+  set->end = (set->end + 1) & (cache->ways - 1);
+
+  set->is_full = (set->end == set->start);
+  return way;
+}
+
+/* Empty marker of the LRU recency list */
+#define LRU_NONE UINT32_MAX
+
+/* Maximum re-reference prediction value of SRRIP, 2 bits per block */
+#define SRRIP_MAX 3
+
+/* Moves way of set index to the front of the recency list, or links
+ * it in if it is not on the list yet
+ */
+static inline void lru_touch(cache_t *cache, uint32_t index, uint32_t way, bool linked)
+{
+  uint32_t *link = &cache->meta[2 * (size_t)index * cache->ways];
+  uint32_t head = cache->set_state[index];
+
+  if (head == way) {
+    return;
+  }
+  if (linked) {
+    link[2 * link[2 * way] + 1] = link[2 * way + 1];
+    link[2 * link[2 * way + 1]] = link[2 * way];
+  }
+  if (head == LRU_NONE) {
+    link[2 * way] = way;
+    link[2 * way + 1] = way;
+  } else {
+    link[2 * way] = link[2 * head];
+    link[2 * way + 1] = head;
+    link[2 * link[2 * head] + 1] = way;
+    link[2 * head] = way;
+  }
+  cache->set_state[index] = way;
+}
+
+/* Points every tree node on the path to way away from it */
+static inline void tree_plru_touch(cache_t *cache, uint32_t index, uint32_t way)
+{
+  size_t base = (size_t)index * cache->ways;
+  uint32_t node = 1;
+
+  for (int level = countBits(cache->ways) - 1; level >= 0; level--) {
+    uint32_t right = (way >> level) & 1;
+    bit_assign(cache->bits, base + node, !right);
+    node = 2 * node + right;
+  }
+}
+
+static inline uint32_t tree_plru_victim(const cache_t *cache, uint32_t index)
+{
+  size_t base = (size_t)index * cache->ways;
+  uint32_t node = 1;
+
+  while (node < cache->ways) {
+    node = 2 * node + bit_test(cache->bits, base + node);
+  }
+  return node - cache->ways;
+}
+
+/* Sets the MRU bit of way, once all bits of the set are set only the
+ * bit of way is kept
+ */
+static inline void bit_plru_touch(cache_t *cache, uint32_t index, uint32_t way)
+{
+  size_t base = (size_t)index * cache->ways;
+
+  if (bit_test(cache->bits, base + way)) {
+    return;
+  }
+  bit_assign(cache->bits, base + way, 1);
+  if (++cache->set_state[index] == cache->ways) {
+    if (cache->ways < 64) {
+      cache->bits[base >> 6] &= ~(((1ULL << cache->ways) - 1) << (base & 63));
+    } else {
+      memset(&cache->bits[base >> 6], 0, (cache->ways / 64) * sizeof(uint64_t));
+    }
+    bit_assign(cache->bits, base + way, 1);
+    cache->set_state[index] = 1;
+  }
+}
+
+static inline uint32_t bit_plru_victim(const cache_t *cache, uint32_t index)
+{
+  size_t base = (size_t)index * cache->ways;
+
+  /* First way with a clear MRU bit */
+  for (uint32_t way = 0; way < cache->ways; way += 64) {
+    uint32_t n = (cache->ways - way < 64) ? cache->ways - way : 64;
+    uint64_t word = cache->bits[(base + way) >> 6] >> ((base + way) & 63);
+    uint64_t clear = ~word & ((n == 64) ? ~0ULL : (1ULL << n) - 1);
+
+    if (clear) {
+      return way + __builtin_ctzll(clear);
+    }
+  }
+  return 0;
+}
+
+static inline uint32_t random_victim(cache_t *cache)
+{
+  /* xorshift64, fixed seed so runs are reproducible */
+  cache->rng ^= cache->rng << 13;
+  cache->rng ^= cache->rng >> 7;
+  cache->rng ^= cache->rng << 17;
+  return (uint32_t)cache->rng & (cache->ways - 1);
+}
+
+/* First way holding value, the caller guarantees there is one */
+static inline uint32_t find_way(const uint32_t *meta, uint32_t value)
+{
+  uint32_t way = 0;
+
+  while (meta[way] != value) {
+    way++;
+  }
+  return way;
+}
+
+/* Least frequently used way, the lowest one on ties */
+static inline uint32_t lfu_victim(const cache_t *cache, uint32_t index)
+{
+  const uint32_t *count = &cache->meta[(size_t)index * cache->ways];
+  uint32_t least = UINT32_MAX;
+
+  /* Branch free reduction, the compiler vectorizes it */
+  for (uint32_t way = 0; way < cache->ways; way++) {
+    least = (count[way] < least) ? count[way] : least;
+  }
+  return find_way(count, least);
+}
+
+/* First way predicted to be re-referenced the latest, ageing the whole
+ * set until one reaches SRRIP_MAX
+ */
+static inline uint32_t srrip_victim(cache_t *cache, uint32_t index)
+{
+  uint32_t *rrpv = &cache->meta[(size_t)index * cache->ways];
+  uint32_t most = 0;
+
+  for (uint32_t way = 0; way < cache->ways; way++) {
+    if (rrpv[way] == SRRIP_MAX) {
+      return way;
+    }
+    most = (rrpv[way] > most) ? rrpv[way] : most;
+  }
+
+  for (uint32_t way = 0; way < cache->ways; way++) {
+    rrpv[way] += SRRIP_MAX - most;
+  }
+  return find_way(rrpv, SRRIP_MAX);
+}
+
+/* Updates the replacement state on a hit, FIFO keeps none */
+static inline __attribute__((always_inline))
+void policy_touch(cache_t *cache, cache_policy_t policy, uint32_t index, uint32_t way)
+{
+  switch (policy) {
+  case rp_lru:
+    lru_touch(cache, index, way, true);
+    break;
+  case rp_tree_plru:
+    tree_plru_touch(cache, index, way);
+    break;
+  case rp_bit_plru:
+    bit_plru_touch(cache, index, way);
+    break;
+  case rp_lfu:
+    cache->meta[(size_t)index * cache->ways + way]++;
+    break;
+  case rp_srrip:
+    cache->meta[(size_t)index * cache->ways + way] = 0;
+    break;
+  default:
+    break;
+  }
+}
+
+/* Updates the replacement state for a block placed in way, linked
+ * tells if the way was filled before
+ */
+static inline __attribute__((always_inline))
+void policy_insert(cache_t *cache, cache_policy_t policy, uint32_t index,
+                   uint32_t way, bool linked)
+{
+  size_t base = (size_t)index * cache->ways;
+
+  switch (policy) {
+  case rp_lru:
+    lru_touch(cache, index, way, linked);
+    break;
+  case rp_lfu:
+    cache->meta[base + way] = 1;
+    break;
+  case rp_srrip:
+    /* Long re-reference interval on insertion */
+    cache->meta[base + way] = SRRIP_MAX - 1;
+    break;
+  default:
+    policy_touch(cache, policy, index, way);
+    break;
+  }
+}
+
+/* Places tag in set index and returns its way, empty ways are filled in
+ * order before the policy picks a victim
+ */
+static inline __attribute__((always_inline))
+uint32_t policy_fill(cache_t *cache, cache_policy_t policy, uint32_t index, uint64_t tag)
+{
+  cache_set_t *set = &cache->set[index];
+  size_t base = (size_t)index * cache->ways;
+  bool evict = set->is_full;
+  uint32_t way;
+
+  if (policy == rp_fifo) {
+    return fill_block(cache, index, tag);
+  }
+
+  if (evict) {
+    switch (policy) {
+    case rp_lru:
+      /* Least recent way is the one before the head */
+      way = cache->meta[2 * (base + cache->set_state[index])];
+      break;
+    case rp_tree_plru:
+      way = tree_plru_victim(cache, index);
+      break;
+    case rp_bit_plru:
+      way = bit_plru_victim(cache, index);
+      break;
+    case rp_lfu:
+      way = lfu_victim(cache, index);
+      break;
+    case rp_srrip:
+      way = srrip_victim(cache, index);
+      break;
+    default:
+      way = random_victim(cache);
+      break;
+    }
+    cache->victim = stored_tag(cache, base + way);
+    writeback_block(cache, base + way);
+    if (cache->hash) {
+      tag_index_remove(cache, index, way);
+    }
+    cache->evicts++;
+  } else {
+    way = set->end;
+    set->end = (set->end + 1) & (cache->ways - 1);
+    set->is_full = (set->end == set->start);
+  }
+
+  SET_BLOCK_VALID(cache, base + way);
+  store_tag(cache, base + way, tag);
+  if (cache->hash) {
+    tag_index_insert(cache, index, way);
+  }
+
+  policy_insert(cache, policy, index, way, evict);
+  return way;
+}
+
+void transfer_address_to_cache(cache_t *cache, const mem_access_t *access)
+{
+  policy_fill(cache, cache->policy, access->index, access->tag);
+}
+
+/* Simulates one access, inlined with a constant policy so every
+ * policy gets its own loop without a dispatch per access
+ */
+static inline __attribute__((always_inline))
+int access_sa(cache_t *cache, cache_policy_t policy, uint32_t index, uint64_t tag)
+{
+  int way = lookup_way(cache, index, tag);
+
+  if (way >= 0) {
+    policy_touch(cache, policy, index, way);
+    return 1;
+  }
+  policy_fill(cache, policy, index, tag);
+  return 0;
+}
+
+/* Tag lookup in a set of a compile-time number of ways, without the
+ * tag index or a call through match_tags
+ */
+static inline __attribute__((always_inline))
+int lookup_way_fixed(const cache_t *cache, uint32_t ways, uint32_t index, uint64_t tag)
+{
+  size_t base = (size_t)index * ways;
+  const uint32_t *block_tag = &cache->tag[base];
+  uint64_t match;
+
+#if defined(__SSE2__)
+  if (ways >= SIMD_MIN_WAYS) {
+    match = match_tags_sse2(block_tag, ways, (uint32_t)tag);
+  } else
+#endif
+  {
+    match = match_tags_scalar(block_tag, ways, (uint32_t)tag);
+  }
+  match &= valid_bits(cache, base, ways);
+  match = match_tags_hi(cache, base, match, tag);
+
+  return match ? (int)__builtin_ctzll(match) : -1;
+}
+
+/**
+ * Simulates a write. A write-back cache marks the block dirty, a write
+ * miss without write-allocate goes around the cache. ways is a constant
+ * in the kernels, 0 if it is only known at runtime.
+*/
+static inline __attribute__((always_inline))
+int access_write(cache_t *cache, cache_map_t mapping, cache_policy_t policy,
+                 uint32_t ways, uint32_t index, uint64_t tag)
+{
+  size_t base = (size_t)index * cache->ways;
+  int hit = 1;
+  int way;
+
+  if (mapping == dm) {
+    way = (BLOCK_VALID(cache, index) && tag_matches(cache, index, tag)) ? 0 : -1;
+  } else if (ways) {
+    way = lookup_way_fixed(cache, ways, index, tag);
+  } else {
+    way = lookup_way(cache, index, tag);
+  }
+
+  if (way >= 0) {
+    if (mapping != dm) {
+      policy_touch(cache, policy, index, way);
+    }
+  } else if (!cache->write_allocate) {
+    cache->write_around++;
+    return 0;
+  } else {
+    hit = 0;
+    if (mapping == dm) {
+      access_dm(cache, index, tag);
+      way = 0;
+    } else {
+      way = policy_fill(cache, policy, index, tag);
+    }
+  }
+
+  if (cache->dirty) {
+    bit_assign(cache->dirty, base + way, 1);
+  }
+  return hit;
+}
+
+/**
+ * A fully associative cache is the special case of a single set
+*/
+int access_cache_fa(cache_t *cache, const mem_access_t *access)
+{
+  return access_sa(cache, cache->policy, access->index, access->tag);
+}
+
+/**
+ * Every set of a set associative cache is replaced on its own, by
+ * default as a FIFO ring buffer
+*/
+int access_cache_sa(cache_t *cache, const mem_access_t *access)
+{
+  return access_sa(cache, cache->policy, access->index, access->tag);
+}
+
+/**
+ * Places tag in set index after a miss. Returns 1 if a block was evicted,
+ * its tag is left in cache->victim. Invalidated ways are refilled first,
+ * they keep their position in the FIFO ring.
+*/
+int cache_fill(cache_t *cache, uint32_t index, uint64_t tag)
+{
+  cache_set_t *set = &cache->set[index];
+  size_t base = (size_t)index * cache->ways;
+  uint64_t evicts = cache->evicts;
+
+  if (set->holes == 0) {
+    policy_fill(cache, cache->policy, index, tag);
+    return cache->evicts != evicts;
+  }
+
+  /* Ways past the end of a filling ring are empty too, but every hole
+   * comes before them
+   */
+  for (uint32_t way = 0; way < cache->ways; way += 64) {
+    uint32_t n = (cache->ways - way < 64) ? cache->ways - way : 64;
+    uint64_t empty = ~valid_bits(cache, base + way, n) &
+                     ((n == 64) ? ~0ULL : (1ULL << n) - 1);
+
+    if (empty) {
+      way += __builtin_ctzll(empty);
+      set->holes--;
+      SET_BLOCK_VALID(cache, base + way);
+      store_tag(cache, base + way, tag);
+      if (cache->hash) {
+        tag_index_insert(cache, index, way);
+      }
+      policy_insert(cache, cache->policy, index, way, true);
+      break;
+    }
+  }
+  return 0;
+}
+
+/* Drops tag from set index, writing it back if dirty. Returns 1 if it
+ * was cached.
+ */
+int cache_invalidate(cache_t *cache, uint32_t index, uint64_t tag)
+{
+  int way = lookup_way(cache, index, tag);
+
+  if (way < 0) {
+    return 0;
+  }
+  if (cache->hash) {
+    tag_index_remove(cache, index, way);
+  }
+  writeback_block(cache, (size_t)index * cache->ways + way);
+  CLEAR_BLOCK_VALID(cache, (size_t)index * cache->ways + way);
+  cache->set[index].holes++;
+  return 1;
+}
+
+/* Decodes index and tag of every access in the batch */
+void set_access_identifiers_batch(const access_batch_t *batch,
+                                  cache_bits_t cache_bits,
+                                  access_ids_t *ids)
+{
+  const uint32_t index_shift = cache_bits.offset;
+  const uint32_t index_mask = MASK(cache_bits.index);
+  const uint32_t tag_shift = cache_bits.index + cache_bits.offset;
+  const uint64_t tag_mask = MASK(cache_bits.tag);
+  const uint64_t *restrict address = batch->address;
+  uint32_t *restrict index = ids->index;
+  uint64_t *restrict tag = ids->tag;
+
+  /* No dependencies between iterations, the compiler vectorizes this */
+  for (size_t i = 0; i < batch->len; i++) {
+    index[i] = (address[i] >> index_shift) & index_mask;
+    tag[i] = (address[i] >> tag_shift) & tag_mask;
+  }
+}
+
+static inline __attribute__((always_inline))
+uint64_t access_sa_batch(cache_t *const caches[2], cache_policy_t policy,
+                         const access_batch_t *batch, const access_ids_t *ids)
+{
+  uint64_t hits = 0;
+
+  for (size_t i = 0; i < batch->len; i++) {
+    hits += access_sa(caches[batch->type[i]], policy, ids->index[i], ids->tag[i]);
+  }
+  return hits;
+}
+
+/**
+ * Simulates a decoded batch and returns the number of hits. caches is
+ * indexed by access type, both entries point to the same cache for a
+ * unified cache.
+*/
+uint64_t access_cache_batch(cache_t *const caches[2],
+                            cache_map_t cache_mapping,
+                            const access_batch_t *batch,
+                            const access_ids_t *ids)
+{
+  uint64_t hits = 0;
+
+  if (batch->writes) {
+    /* Reads and writes mixed, one access at a time */
+    for (size_t i = 0; i < batch->len; i++) {
+      cache_t *cache = caches[batch->type[i]];
+
+      if (batch->write[i]) {
+        hits += access_write(cache, cache_mapping, cache->policy, 0,
+                             ids->index[i], ids->tag[i]);
+      } else if (cache_mapping == dm) {
+        hits += access_dm(cache, ids->index[i], ids->tag[i]);
+      } else {
+        hits += access_sa(cache, cache->policy, ids->index[i], ids->tag[i]);
+      }
+    }
+    return hits;
+  }
+
+  if (cache_mapping == dm) {
+    for (size_t i = 0; i < batch->len; i++) {
+      hits += access_dm(caches[batch->type[i]], ids->index[i], ids->tag[i]);
+    }
+  } else { /* fully or set associative, both caches share the policy */
+    switch (caches[0]->policy) {
+    case rp_fifo:
+      hits = access_sa_batch(caches, rp_fifo, batch, ids);
+      break;
+    case rp_lru:
+      hits = access_sa_batch(caches, rp_lru, batch, ids);
+      break;
+    case rp_tree_plru:
+      hits = access_sa_batch(caches, rp_tree_plru, batch, ids);
+      break;
+    case rp_bit_plru:
+      hits = access_sa_batch(caches, rp_bit_plru, batch, ids);
+      break;
+    case rp_random:
+      hits = access_sa_batch(caches, rp_random, batch, ids);
+      break;
+    case rp_lfu:
+      hits = access_sa_batch(caches, rp_lfu, batch, ids);
+      break;
+    case rp_srrip:
+      hits = access_sa_batch(caches, rp_srrip, batch, ids);
+      break;
+    }
+  }
+
+  return hits;
+}
+
+/* Set associative kernels exist for 2 to KERNEL_MAX_WAYS ways */
+#define KERNEL_MAX_WAYS 16
+
+/**
+ * Decodes and simulates a batch of one configuration. Every argument but
+ * sim and batch is a constant in the kernels, so the configuration
+ * branches fold away. The shifts and mask of the block size and index are
+ * loaded once per batch. ways is 0 when it is only known at runtime,
+ * writes is false for read only batches.
+*/
+static inline __attribute__((always_inline))
+uint64_t simulate_batch(cache_sim_t *sim, const access_batch_t *batch,
+                        cache_map_t mapping, cache_org_t org,
+                        cache_policy_t policy, uint32_t ways, bool writes)
+{
+  const uint32_t offset = sim->bits.offset;
+  const uint32_t index_mask = MASK(sim->bits.index);
+  const uint32_t tag_shift = sim->bits.index + offset;
+  uint64_t hits = 0;
+
+  for (size_t i = 0; i < batch->len; i++) {
+    uint64_t address = batch->address[i];
+    cache_t *cache = &sim->cache[(org == uc) ? 0 : batch->type[i]];
+    uint32_t index = (mapping == fa) ? 0 : (address >> offset) & index_mask;
+    uint64_t tag = (mapping == fa) ? address >> offset : address >> tag_shift;
+
+    if (writes && batch->write[i]) {
+      hits += access_write(cache, mapping, policy, ways, index, tag);
+    } else if (mapping == dm) {
+      hits += access_dm(cache, index, tag);
+    } else if (ways) {
+      int way = lookup_way_fixed(cache, ways, index, tag);
+      if (way >= 0) {
+        policy_touch(cache, policy, index, way);
+        hits++;
+      } else {
+        policy_fill(cache, policy, index, tag);
+      }
+    } else {
+      hits += access_sa(cache, policy, index, tag);
+    }
+  }
+
+  return hits;
+}
+
+#define KERNEL(m, o, p, w) kernel_##m##_##o##_##p##_##w
+
+#define DEFINE_KERNEL(m, o, p, w) \
+  static uint64_t KERNEL(m, o, p, w)(cache_sim_t *sim, const access_batch_t *batch) \
+  { \
+    if (batch->writes) { \
+      return simulate_batch(sim, batch, m, o, p, w, true); \
+    } \
+    return simulate_batch(sim, batch, m, o, p, w, false); \
+  }
+
+#define DEFINE_POLICY_KERNELS(m, o, w) \
+  DEFINE_KERNEL(m, o, rp_fifo, w) \
+  DEFINE_KERNEL(m, o, rp_lru, w) \
+  DEFINE_KERNEL(m, o, rp_tree_plru, w) \
+  DEFINE_KERNEL(m, o, rp_bit_plru, w) \
+  DEFINE_KERNEL(m, o, rp_random, w) \
+  DEFINE_KERNEL(m, o, rp_lfu, w) \
+  DEFINE_KERNEL(m, o, rp_srrip, w)
+
+#define DEFINE_ORG_KERNELS(o) \
+  DEFINE_KERNEL(dm, o, rp_fifo, 1) \
+  DEFINE_POLICY_KERNELS(fa, o, 0) \
+  DEFINE_POLICY_KERNELS(sa, o, 0) \
+  DEFINE_POLICY_KERNELS(sa, o, 2) \
+  DEFINE_POLICY_KERNELS(sa, o, 4) \
+  DEFINE_POLICY_KERNELS(sa, o, 8) \
+  DEFINE_POLICY_KERNELS(sa, o, 16)
+
+DEFINE_ORG_KERNELS(uc)
+DEFINE_ORG_KERNELS(sc)
+
+#define POLICY_KERNELS(m, o, w) { \
+  KERNEL(m, o, rp_fifo, w), KERNEL(m, o, rp_lru, w), \
+  KERNEL(m, o, rp_tree_plru, w), KERNEL(m, o, rp_bit_plru, w), \
+  KERNEL(m, o, rp_random, w), KERNEL(m, o, rp_lfu, w), \
+  KERNEL(m, o, rp_srrip, w) }
+
+#define ORG_KERNELS(o) { \
+  POLICY_KERNELS(sa, o, 0), POLICY_KERNELS(sa, o, 2), POLICY_KERNELS(sa, o, 4), \
+  POLICY_KERNELS(sa, o, 8), POLICY_KERNELS(sa, o, 16), POLICY_KERNELS(fa, o, 0) }
+
+typedef uint64_t (*cache_kernel_t)(cache_sim_t *sim, const access_batch_t *batch);
+
+static const cache_kernel_t dm_kernels[2] = {
+  KERNEL(dm, uc, rp_fifo, 1), KERNEL(dm, sc, rp_fifo, 1)
+};
+
+/* Indexed by organization, log2 of the ways (0 for any other number of
+ * ways, 5 for fully associative) and policy
+ */
+static const cache_kernel_t assoc_kernels[2][6][7] = {
+  ORG_KERNELS(uc), ORG_KERNELS(sc)
+};
+
+/* Way of set index holding tag, -1 if it is not cached */
+static inline int cached_way(const cache_t *cache, cache_map_t mapping,
+                           uint32_t index, uint64_t tag)
+{
+  if (mapping == dm) {
+    return (BLOCK_VALID(cache, index) && tag_matches(cache, index, tag)) ? 0 : -1;
+  }
+  return lookup_way(cache, index, tag);
+}
+
+static inline size_t filter_slot(uint64_t block)
+{
+  return (size_t)((block * 0x9E3779B97F4A7C15ULL) >> 32) & (POLLUTION_FILTER_SIZE - 1);
+}
+
+static bool victim_cache_holds(const victim_cache_t *vc, uint64_t block)
+{
+  for (uint32_t i = 0; i < vc->blocks; i++) {
+    if (vc->block[i] == block + 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Takes block out of the victim cache and puts victim, the block its fill
+ * evicted, in its entry. If block is not held victim replaces the least
+ * recently used entry. evicted is false when the fill evicted nothing.
+ * Returns true if block was held.
+ */
+static bool victim_cache_swap(victim_cache_t *vc, uint64_t block, uint64_t victim,
+                              bool evicted)
+{
+  uint32_t lru = 0;
+
+  /* One pass finds the block or the entry to replace */
+  for (uint32_t i = 0; i < vc->blocks; i++) {
+    if (vc->block[i] == block + 1) {
+      vc->block[i] = evicted ? victim + 1 : 0;
+      vc->used[i] = evicted ? ++vc->clock : 0;
+      return true;
+    }
+    lru = (vc->used[i] < vc->used[lru]) ? i : lru;
+  }
+  if (evicted) {
+    vc->block[lru] = victim + 1;
+    vc->used[lru] = ++vc->clock;
+  }
+  return false;
+}
+
+static inline size_t seen_slot(const miss_classifier_t *cls, uint64_t key)
+{
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (cls->map_size - 1);
+}
+
+/* Map slot of block, empty if it was never seen */
+static inline size_t classifier_slot(const miss_classifier_t *cls, uint64_t block)
+{
+  size_t mask = cls->map_size - 1;
+  size_t i = seen_slot(cls, block + 1);
+
+  while (cls->seen[i].key != 0 && cls->seen[i].key != block + 1) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* Rehashes the map into one twice the size, moving the shadow's slots */
+static void classifier_grow(miss_classifier_t *cls)
+{
+  seen_entry_t *old = cls->seen;
+  size_t old_size = cls->map_size;
+
+  cls->map_size *= 2;
+  cls->seen = calloc(cls->map_size, sizeof(seen_entry_t));
+  if (!cls->seen) {
+    printf("Failed to allocate memory for the miss classifier\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < old_size; i++) {
+    if (old[i].key) {
+      size_t slot = classifier_slot(cls, old[i].key - 1);
+
+      cls->seen[slot] = old[i];
+      if (old[i].way) {
+        cls->slot[old[i].way - 1] = slot;
+      }
+    }
+  }
+  free(old);
+}
+
+/* Makes way the most recent of the shadow */
+static inline void shadow_touch(miss_classifier_t *cls, uint32_t way)
+{
+  if (way == cls->head) {
+    return;
+  }
+  cls->next[cls->prev[way]] = cls->next[way];
+  cls->prev[cls->next[way]] = cls->prev[way];
+  cls->prev[way] = cls->prev[cls->head];
+  cls->next[way] = cls->head;
+  cls->next[cls->prev[cls->head]] = way;
+  cls->prev[cls->head] = way;
+  cls->head = way;
+}
+
+/* Places the block of map slot in the shadow, evicting its least recent
+ * way once every way is filled
+ */
+static inline void shadow_fill(miss_classifier_t *cls, size_t slot)
+{
+  uint32_t way;
+
+  if (cls->filled < cls->length) {
+    way = cls->filled++;
+    if (way == 0) {
+      cls->prev[way] = way;
+      cls->next[way] = way;
+    } else {
+      cls->prev[way] = cls->prev[cls->head];
+      cls->next[way] = cls->head;
+      cls->next[cls->prev[cls->head]] = way;
+      cls->prev[cls->head] = way;
+    }
+  } else {
+    /* The least recent way is the one before the head of the circle */
+    way = cls->prev[cls->head];
+    cls->seen[cls->slot[way]].way = 0;
+  }
+  cls->head = way;
+  cls->slot[way] = slot;
+  cls->seen[slot].way = way + 1;
+}
+
+/* Runs the access through the shadow cache and classifies it if it
+ * missed the simulated cache
+ */
+static void classify_access(cache_sim_t *sim, miss_classifier_t *cls, uint64_t block,
+                            bool write, int hit)
+{
+  size_t slot = classifier_slot(cls, block);
+
+  if (cls->seen[slot].key == 0) {
+    sim->stats.compulsory_misses += !hit;
+    cls->seen[slot].key = block + 1;
+    cls->count++;
+  } else if (cls->seen[slot].way) {
+    sim->stats.conflict_misses += !hit;
+    shadow_touch(cls, cls->seen[slot].way - 1);
+    return;
+  } else {
+    sim->stats.capacity_misses += !hit;
+  }
+
+  if (!write || cls->write_allocate) {
+    shadow_fill(cls, slot);
+  }
+  /* Keep the map at most half full */
+  if (cls->count * 2 > cls->map_size) {
+    classifier_grow(cls);
+  }
+}
+
+/* Called after a fill at block slot of the cache evicted victim. A
+ * prefetched block leaving unused was a useless prefetch, a demand block
+ * pushed out by a prefetch is remembered for pollution misses.
+ */
+static void prefetch_evicted(cache_sim_t *sim, prefetcher_t *pf, uint64_t victim,
+                             size_t slot, bool by_prefetch)
+{
+  if (bit_test(pf->prefetched, slot)) {
+    sim->stats.useless_prefetches++;
+  } else if (by_prefetch) {
+    sim->stats.prefetch_evicts++;
+    pf->filter[filter_slot(victim)] = victim + 1;
+  }
+}
+
+/* Fills block into cache type unless it is already cached */
+static void prefetch_block(cache_sim_t *sim, int type, uint64_t block)
+{
+  const cache_map_t mapping = sim->config.mapping;
+  cache_t *cache = &sim->cache[type];
+  prefetcher_t *pf = &sim->prefetcher[type];
+  victim_cache_t *vc = sim->victim_cache ? &sim->victim_cache[type] : NULL;
+  uint32_t index = block & MASK(sim->bits.index);
+  uint64_t tag = block >> sim->bits.index;
+  uint64_t evicts = cache->evicts;
+  size_t slot;
+
+  if (cached_way(cache, mapping, index, tag) >= 0 ||
+      (vc && victim_cache_holds(vc, block))) {
+    return;
+  }
+
+  if (mapping == dm) {
+    /* access_dm() does not record its victim */
+    cache->victim = stored_tag(cache, index);
+    access_dm(cache, index, tag);
+    slot = index;
+  } else {
+    slot = (size_t)index * cache->ways + policy_fill(cache, cache->policy, index, tag);
+  }
+  sim->stats.prefetches++;
+
+  if (cache->evicts != evicts) {
+    uint64_t victim = (cache->victim << sim->bits.index) | index;
+
+    if (vc) {
+      /* The prefetched block is not held, the victim takes an entry */
+      victim_cache_swap(vc, block, victim, true);
+    }
+    prefetch_evicted(sim, pf, victim, slot, true);
+  }
+  bit_assign(pf->prefetched, slot, 1);
+}
+
+/* Looks a missed block up in the stream buffers, returns 1 if one of them
+ * holds it. Buffers stay STREAM_DEPTH blocks ahead, a miss in all of them
+ * restarts the least recently used buffer after the block.
+ */
+static int stream_access(cache_sim_t *sim, prefetcher_t *pf, uint64_t block)
+{
+  stream_buffer_t *lru = &pf->stream[0];
+
+  pf->clock++;
+  for (int i = 0; i < STREAM_BUFFERS; i++) {
+    stream_buffer_t *stream = &pf->stream[i];
+
+    if (stream->count && block - stream->head < stream->count) {
+      /* Blocks before it are skipped and dropped */
+      sim->stats.useless_prefetches += block - stream->head;
+      sim->stats.useful_prefetches++;
+      sim->stats.prefetches += STREAM_DEPTH - (stream->count - (block - stream->head) - 1);
+      stream->head = block + 1;
+      stream->count = STREAM_DEPTH;
+      stream->used = pf->clock;
+      return 1;
+    }
+    if (stream->used < lru->used) {
+      lru = stream;
+    }
+  }
+
+  sim->stats.useless_prefetches += lru->count;
+  sim->stats.prefetches += STREAM_DEPTH;
+  lru->head = block + 1;
+  lru->count = STREAM_DEPTH;
+  lru->used = pf->clock;
+  return 0;
+}
+
+/* Trains the stride table of the block's region and prefetches along a
+ * stride seen twice in a row
+ */
+static void stride_access(cache_sim_t *sim, int type, uint64_t block)
+{
+  prefetcher_t *pf = &sim->prefetcher[type];
+  uint64_t region = ((block << sim->bits.offset) >> STRIDE_REGION_BITS) + 1;
+  stride_entry_t *entry = &pf->stride[region & (STRIDE_TABLE_SIZE - 1)];
+  int64_t stride = (int64_t)(block - entry->last);
+
+  if (entry->region != region) {
+    entry->region = region;
+    entry->last = block;
+    entry->stride = 0;
+    entry->confidence = 0;
+    return;
+  }
+  if (stride == 0) {
+    return;
+  }
+
+  if (stride == entry->stride) {
+    entry->confidence += (entry->confidence < 3);
+  } else {
+    entry->stride = stride;
+    entry->confidence = 0;
+  }
+  entry->last = block;
+
+  if (entry->confidence) {
+    for (int d = 1; d <= PREFETCH_DEGREE; d++) {
+      /* A descending stream ends at address 0 */
+      if (stride < 0 && (uint64_t)-stride * d > block) {
+        break;
+      }
+      prefetch_block(sim, type, block + d * stride);
+    }
+  }
+}
+
+/**
+ * Simulates a demand access of a cache with a prefetcher, victim cache or
+ * miss classifier. The access itself takes the same path as without them,
+ * they see every miss and the block its fill evicted.
+*/
+static int instrumented_access(cache_sim_t *sim, int type, uint64_t address, bool write)
+{
+  const cache_map_t mapping = sim->config.mapping;
+  cache_t *cache = &sim->cache[type];
+  prefetcher_t *pf = sim->prefetcher ? &sim->prefetcher[type] : NULL;
+  victim_cache_t *vc = sim->victim_cache ? &sim->victim_cache[type] : NULL;
+  uint64_t block = address >> sim->bits.offset;
+  uint32_t index = block & MASK(sim->bits.index);
+  uint64_t tag = block >> sim->bits.index;
+  uint64_t evicts = cache->evicts;
+  /* access_dm() does not record its victim */
+  uint64_t dm_victim = (mapping == dm) ? stored_tag(cache, index) : 0;
+  bool trigger = false;
+  int way, hit;
+
+  if (pf) {
+    way = cached_way(cache, mapping, index, tag);
+    if (way >= 0 && bit_test(pf->prefetched, (size_t)index * cache->ways + way)) {
+      /* First use of a prefetched block */
+      sim->stats.useful_prefetches++;
+      bit_assign(pf->prefetched, (size_t)index * cache->ways + way, 0);
+      trigger = true;
+    }
+  }
+
+  if (write) {
+    hit = access_write(cache, mapping, cache->policy, 0, index, tag);
+  } else if (mapping == dm) {
+    hit = access_dm(cache, index, tag);
+  } else {
+    hit = access_sa(cache, cache->policy, index, tag);
+  }
+
+  if (!hit) {
+    /* A write around the cache fills nothing and skips the victim cache */
+    way = cached_way(cache, mapping, index, tag);
+    if (way >= 0) {
+      size_t slot = (size_t)index * cache->ways + way;
+      bool evicted = (cache->evicts != evicts);
+      uint64_t victim = ((mapping == dm) ? dm_victim : cache->victim) << sim->bits.index | index;
+
+      if (vc && victim_cache_swap(vc, block, victim, evicted)) {
+        sim->stats.victim_hits++;
+        hit = 1;
+      }
+      if (pf) {
+        if (evicted) {
+          prefetch_evicted(sim, pf, victim, slot, false);
+        }
+        bit_assign(pf->prefetched, slot, 0);
+      }
+    }
+    trigger = true;
+  }
+
+  if (pf) {
+    if (!hit) {
+      uint64_t *filtered = &pf->filter[filter_slot(block)];
+
+      if (*filtered == block + 1) {
+        sim->stats.pollution_misses++;
+        *filtered = 0;
+      }
+    }
+
+    switch (pf->kind) {
+    case pf_next_line:
+      if (trigger) {
+        prefetch_block(sim, type, block + 1);
+      }
+      break;
+    case pf_stride:
+      if (trigger) {
+        stride_access(sim, type, block);
+      }
+      break;
+    case pf_stream:
+      if (!hit) {
+        hit = stream_access(sim, pf, block);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (sim->classifier) {
+    classify_access(sim, &sim->classifier[type], block, write, hit);
+  }
+  return hit;
+}
+
+/* Configurations with a prefetcher, victim cache or miss classifier, the
+ * other kernels never see them
+ */
+static uint64_t kernel_instrumented(cache_sim_t *sim, const access_batch_t *batch)
+{
+  uint64_t hits = 0;
+
+  for (size_t i = 0; i < batch->len; i++) {
+    int type = (sim->config.org == uc) ? 0 : batch->type[i];
+
+    /* Seen set probes mostly miss the data caches, start them early */
+    if (sim->classifier && i + SEEN_LOOKAHEAD < batch->len) {
+      size_t j = i + SEEN_LOOKAHEAD;
+      const miss_classifier_t *cls =
+        &sim->classifier[(sim->config.org == uc) ? 0 : batch->type[j]];
+
+      __builtin_prefetch(&cls->seen[seen_slot(cls, (batch->address[j] >> sim->bits.offset) + 1)]);
+    }
+    hits += instrumented_access(sim, type, batch->address[i], batch->write[i]);
+  }
+  return hits;
+}
+
+/* Simulates the accesses to sampled sets group by group. Their hits are
+ * kept per group and extrapolated later, so none are returned.
+ */
+static uint64_t kernel_sampled(cache_sim_t *sim, const access_batch_t *batch)
+{
+  set_sampler_t *smp = sim->sampler;
+  const uint32_t index_mask = MASK(sim->bits.index);
+  size_t n[SAMPLE_GROUPS] = {0};
+  size_t writes[SAMPLE_GROUPS] = {0};
+
+  for (size_t i = 0; i < batch->len; i++) {
+    uint32_t group = smp->group[(batch->address[i] >> sim->bits.offset) & index_mask];
+
+    if (group) {
+      access_batch_t *own = &smp->batch[group - 1];
+      size_t k = n[group - 1]++;
+
+      own->address[k] = batch->address[i];
+      own->type[k] = batch->type[i];
+      own->write[k] = batch->write[i];
+      writes[group - 1] += batch->write[i];
+    }
+  }
+
+  for (uint32_t g = 0; g < SAMPLE_GROUPS; g++) {
+    if (n[g]) {
+      smp->batch[g].len = n[g];
+      smp->batch[g].writes = writes[g];
+      smp->accesses[g] += n[g];
+      smp->hits[g] += smp->kernel(sim, &smp->batch[g]);
+    }
+  }
+  return 0;
+}
+
+/* Picks the most specialized kernel of the configuration, once */
+static cache_kernel_t select_cache_kernel(const cache_sim_t *sim)
+{
+  const cache_config_t *config = &sim->config;
+
+  if (config->prefetch != pf_none || config->victim || config->classify) {
+    return kernel_instrumented;
+  }
+  if (config->mapping == dm) {
+    return dm_kernels[config->org];
+  }
+  if (config->mapping == fa) {
+    return assoc_kernels[config->org][5][config->policy];
+  }
+  if (sim->ways >= 2 && sim->ways <= KERNEL_MAX_WAYS) {
+    return assoc_kernels[config->org][countBits(sim->ways)][config->policy];
+  }
+  return assoc_kernels[config->org][0][config->policy];
+}
+
+static const char *mapping_name[] = { "dm", "fa", "sa" };
+static const char *org_name[] = { "uc", "sc" };
+static const char *policy_name[] = {
+  "fifo", "lru", "plru", "bitplru", "random", "lfu", "srrip"
+};
+static const char *write_policy_name[] = { "wb", "wt", "wb-nwa", "wt-nwa" };
+static const char *prefetch_name[] = { "none", "next", "stride", "stream" };
+
+int parse_cache_policy(cache_policy_t *policy, const char *name)
+{
+  for (size_t i = 0; i < sizeof(policy_name) / sizeof(policy_name[0]); i++) {
+    if (strcmp(name, policy_name[i]) == 0) {
+      *policy = (cache_policy_t)i;
+      return 0;
+    }
+  }
+  printf("Unknown replacement policy\n");
+  return -1;
+}
+
+int parse_write_policy(write_policy_t *write, const char *name)
+{
+  for (size_t i = 0; i < sizeof(write_policy_name) / sizeof(write_policy_name[0]); i++) {
+    if (strcmp(name, write_policy_name[i]) == 0) {
+      *write = (write_policy_t)i;
+      return 0;
+    }
+  }
+  printf("Unknown write policy\n");
+  return -1;
+}
+
+int parse_prefetcher(prefetch_t *prefetch, const char *name)
+{
+  for (size_t i = 0; i < sizeof(prefetch_name) / sizeof(prefetch_name[0]); i++) {
+    if (strcmp(name, prefetch_name[i]) == 0) {
+      *prefetch = (prefetch_t)i;
+      return 0;
+    }
+  }
+  printf("Unknown prefetcher\n");
+  return -1;
+}
+
+/* Parses and verifies a cache configuration given as strings */
+int parse_cache_config(cache_config_t *config, const char *size,
+                       const char *mapping, const char *org, uint32_t assoc)
+{
+  /* Set cache size */
+  config->size = parse_cache_size(size);
+  if (verify_cache_size(config->size)) {
+    return -1;
+  }
+
+  /* Set Cache Mapping */
+  if (strcmp(mapping, "dm") == 0) {
+    config->mapping = dm;
+  } else if (strcmp(mapping, "fa") == 0) {
+    config->mapping = fa;
+  } else if (strcmp(mapping, "sa") == 0) {
+    config->mapping = sa;
+  } else {
+    printf("Unknown cache mapping\n");
+    return -1;
+  }
+
+  /* Set Cache Organization */
+  if (strcmp(org, "uc") == 0) {
+    config->org = uc;
+  } else if (strcmp(org, "sc") == 0) {
+    config->org = sc;
+  } else {
+    printf("Unknown cache organization\n");
+    return -1;
+  }
+
+  config->assoc = assoc;
+  config->policy = rp_fifo;
+  config->write = wp_wb;
+  config->block = DEFAULT_BLOCK_SIZE;
+  config->prefetch = pf_none;
+  config->victim = 0;
+  config->classify = false;
+  config->sample = 0;
+  return 0;
+}
+
+/* Picks the sampled sets and takes over the kernel */
+static int set_sampler_init(cache_sim_t *sim)
+{
+  const cache_config_t *config = &sim->config;
+  set_sampler_t *smp;
+
+  if (config->mapping == fa) {
+    printf("Set sampling needs a direct mapped or set associative cache\n");
+    return -1;
+  }
+  if (sim->kernel == kernel_instrumented) {
+    printf("Prefetchers, victim caches and miss classification span sets, "
+           "they are not sampled\n");
+    return -1;
+  }
+
+  smp = calloc(1, sizeof(set_sampler_t));
+  if (!smp) {
+    printf("Failed to allocate memory for set sampling\n");
+    return -1;
+  }
+  sim->sampler = smp;
+  smp->rate = config->sample;
+  smp->sets = sim->length / sim->ways;
+  smp->group = calloc(smp->sets, sizeof(uint8_t));
+  smp->batch = malloc(SAMPLE_GROUPS * sizeof(access_batch_t));
+  if (!smp->group || !smp->batch) {
+    printf("Failed to allocate memory for set sampling\n");
+    return -1;
+  }
+  for (uint32_t set = 0; set < smp->sets; set++) {
+    if ((((set + 1) * 0x9E3779B97F4A7C15ULL) >> 32) % smp->rate == 0) {
+      smp->group[set] = smp->sampled++ % SAMPLE_GROUPS + 1;
+    }
+  }
+  if (smp->sampled < SAMPLE_GROUPS) {
+    printf("Sampling 1 in %u of %u sets leaves %u, at least %u are needed\n",
+           smp->rate, smp->sets, smp->sampled, SAMPLE_GROUPS);
+    return -1;
+  }
+
+  smp->kernel = sim->kernel;
+  sim->kernel = kernel_sampled;
+  return 0;
+}
+
+int cache_sim_init(cache_sim_t *sim, const cache_config_t *config)
+{
+  memset(sim, 0, sizeof(cache_sim_t));
+  sim->config = *config;
+
+  if (verify_block_size(config->block)) {
+    return -1;
+  }
+  sim->length = get_cache_length(config->size, config->org, config->block);
+  if (sim->length == 0) {
+    printf("Cache size is too small for the block size\n");
+    return -1;
+  }
+  sim->ways = get_cache_ways(sim->length, config->mapping, config->assoc);
+  if (!is_power_of_two(sim->ways) || sim->ways > sim->length) {
+    printf("Invalid number of ways. It must be a power of 2, at most %u\n",
+           sim->length);
+    return -1;
+  }
+
+  /* Decoded ids are private to the configuration */
+  sim->ids = malloc(sizeof(access_ids_t));
+  if (!sim->ids) {
+    printf("Failed to allocate memory for the access batch\n");
+    return -1;
+  }
+
+  /** Allocate memory for cache **/
+  if (config->org == uc) {
+    if (cache_init(&sim->cache[0], sim->length, sim->ways, config->policy)) {
+      free(sim->ids);
+      printf("Failed to allocate memory for unified cache\n");
+      return -1;
+    }
+    sim->caches[instruction] = &sim->cache[0];
+    sim->caches[data] = &sim->cache[0];
+  } else { /* split cache */
+    if (cache_init(&sim->cache[data], sim->length, sim->ways, config->policy)) {
+      printf("Failed to allocate memory for data cache\n");
+      free(sim->ids);
+      return -1;
+    }
+    if (cache_init(&sim->cache[instruction], sim->length, sim->ways, config->policy)) {
+      printf("Failed to allocate memory for instruction cache\n");
+      cache_deinit(&sim->cache[data]);
+      free(sim->ids);
+      return -1;
+    }
+    sim->caches[instruction] = &sim->cache[instruction];
+    sim->caches[data] = &sim->cache[data];
+  }
+
+  for (int i = 0; i < ((config->org == sc) ? 2 : 1); i++) {
+    if (cache_set_write_policy(&sim->cache[i], config->write)) {
+      cache_sim_deinit(sim);
+      return -1;
+    }
+  }
+
+  if (config->prefetch != pf_none) {
+    sim->prefetcher = calloc(2, sizeof(prefetcher_t));
+    if (!sim->prefetcher) {
+      printf("Failed to allocate memory for the prefetcher\n");
+      cache_sim_deinit(sim);
+      return -1;
+    }
+    for (int i = 0; i < ((config->org == sc) ? 2 : 1); i++) {
+      prefetcher_t *pf = &sim->prefetcher[i];
+
+      pf->kind = config->prefetch;
+      pf->prefetched = calloc(((size_t)sim->length + 63) / 64, sizeof(uint64_t));
+      pf->filter = calloc(POLLUTION_FILTER_SIZE, sizeof(uint64_t));
+      if (!pf->prefetched || !pf->filter) {
+        printf("Failed to allocate memory for the prefetcher\n");
+        cache_sim_deinit(sim);
+        return -1;
+      }
+    }
+  }
+
+  if (config->victim) {
+    if (config->victim > VICTIM_MAX_BLOCKS) {
+      printf("Victim cache holds at most %u blocks\n", VICTIM_MAX_BLOCKS);
+      cache_sim_deinit(sim);
+      return -1;
+    }
+    sim->victim_cache = calloc(2, sizeof(victim_cache_t));
+    if (!sim->victim_cache) {
+      printf("Failed to allocate memory for the victim cache\n");
+      cache_sim_deinit(sim);
+      return -1;
+    }
+    sim->victim_cache[0].blocks = config->victim;
+    sim->victim_cache[1].blocks = config->victim;
+  }
+
+  if (config->classify) {
+    sim->classifier = calloc(2, sizeof(miss_classifier_t));
+    if (!sim->classifier) {
+      printf("Failed to allocate memory for the miss classifier\n");
+      cache_sim_deinit(sim);
+      return -1;
+    }
+    for (int i = 0; i < ((config->org == sc) ? 2 : 1); i++) {
+      miss_classifier_t *cls = &sim->classifier[i];
+
+      cls->map_size = SEEN_MIN_SIZE;
+      cls->seen = calloc(cls->map_size, sizeof(seen_entry_t));
+      cls->length = sim->length;
+      cls->slot = malloc((size_t)sim->length * sizeof(size_t));
+      cls->prev = malloc((size_t)sim->length * sizeof(uint32_t));
+      cls->next = malloc((size_t)sim->length * sizeof(uint32_t));
+      cls->write_allocate = (config->write == wp_wb || config->write == wp_wt);
+      if (!cls->seen || !cls->slot || !cls->prev || !cls->next) {
+        printf("Failed to allocate memory for the miss classifier\n");
+        cache_sim_deinit(sim);
+        return -1;
+      }
+    }
+  }
+
+  /* Get cache bits, which will be used in placing memory transfers */
+  set_cache_bits(&sim->bits, sim->length, sim->ways, config->mapping, config->org,
+                 config->block);
+  sim->kernel = select_cache_kernel(sim);
+
+  if (config->sample > 1 && set_sampler_init(sim)) {
+    cache_sim_deinit(sim);
+    return -1;
+  }
+
+  return 0;
+}
+
+void cache_sim_deinit(cache_sim_t *sim)
+{
+  cache_deinit(&sim->cache[0]);
+  if (sim->config.org == sc) {
+    cache_deinit(&sim->cache[1]);
+  }
+  if (sim->snapshot) {
+    munmap(sim->snapshot, sim->snapshot_size);
+    sim->snapshot = NULL;
+  }
+  free(sim->ids);
+  sim->ids = NULL;
+  if (sim->prefetcher) {
+    for (int i = 0; i < 2; i++) {
+      free(sim->prefetcher[i].prefetched);
+      free(sim->prefetcher[i].filter);
+    }
+    free(sim->prefetcher);
+    sim->prefetcher = NULL;
+  }
+  free(sim->victim_cache);
+  sim->victim_cache = NULL;
+  if (sim->classifier) {
+    for (int i = 0; i < 2; i++) {
+      miss_classifier_t *cls = &sim->classifier[i];
+
+      free(cls->seen);
+      free(cls->slot);
+      free(cls->prev);
+      free(cls->next);
+    }
+    free(sim->classifier);
+    sim->classifier = NULL;
+  }
+  if (sim->sampler) {
+    free(sim->sampler->group);
+    free(sim->sampler->batch);
+    free(sim->sampler);
+    sim->sampler = NULL;
+  }
+}
+
+/* Derives the statistics kept by the caches themselves and the traffic */
+static void cache_sim_update_stats(cache_sim_t *sim)
+{
+  uint64_t write_around;
+  bool write_back = (sim->config.write == wp_wb || sim->config.write == wp_wb_nwa);
+
+  sim->stats.evicts = sim->cache[0].evicts;
+  sim->stats.writebacks = sim->cache[0].writebacks;
+  write_around = sim->cache[0].write_around;
+  if (sim->config.org == sc) {
+    sim->stats.evicts += sim->cache[1].evicts;
+    sim->stats.writebacks += sim->cache[1].writebacks;
+    write_around += sim->cache[1].write_around;
+  }
+
+  /* Scale the sampled sets up to all accesses */
+  if (sim->sampler) {
+    uint64_t accesses = 0;
+    uint64_t hits = 0;
+    double scale;
+
+    for (uint32_t g = 0; g < SAMPLE_GROUPS; g++) {
+      accesses += sim->sampler->accesses[g];
+      hits += sim->sampler->hits[g];
+    }
+    scale = accesses ? (double)sim->stats.accesses / accesses : 0.0;
+    sim->stats.hits = llround(hits * scale);
+    sim->stats.evicts = llround(sim->stats.evicts * scale);
+    sim->stats.writebacks = llround(sim->stats.writebacks * scale);
+    write_around = llround(write_around * scale);
+  }
+
+  /* Every miss fills a block unless the write went around the cache,
+   * and so does every prefetch
+   */
+  sim->stats.read_bytes = (sim->stats.accesses - sim->stats.hits - write_around +
+                           sim->stats.prefetches) * sim->config.block;
+  if (write_back) {
+    sim->stats.write_bytes = sim->stats.writebacks * sim->config.block +
+                             write_around * WRITE_THROUGH_BYTES;
+  } else {
+    sim->stats.write_bytes = sim->stats.writes * WRITE_THROUGH_BYTES;
+  }
+}
+
+/* Decodes a batch for this configuration and simulates it. Only the
+ * configuration itself is written, so different configurations may run
+ * on the same batch concurrently.
+ */
+void cache_sim_run_batch(cache_sim_t *sim, const access_batch_t *batch)
+{
+  sim->stats.accesses += batch->len;
+  sim->stats.writes += batch->writes;
+  sim->stats.hits += sim->kernel(sim, batch);
+  cache_sim_update_stats(sim);
+}
+
+/* Two sided 95% quantile of Student's t with SAMPLE_GROUPS - 1 degrees of freedom */
+#define SAMPLE_T95 2.131
+
+/**
+ * Half width of the 95% confidence interval of the hit rate of a sampled
+ * simulation, 0 if it is exact. The groups are random samples of the
+ * sets, the variance of the ratio estimate follows from their spread,
+ * corrected for the fraction of sets sampled.
+*/
+double cache_sim_hit_rate_ci(const cache_sim_t *sim)
+{
+  const set_sampler_t *smp = sim->sampler;
+  uint64_t accesses = 0;
+  uint64_t hits = 0;
+  double rate, mean, sum = 0.0;
+
+  if (!smp) {
+    return 0.0;
+  }
+  for (uint32_t g = 0; g < SAMPLE_GROUPS; g++) {
+    accesses += smp->accesses[g];
+    hits += smp->hits[g];
+  }
+  if (accesses == 0) {
+    return 0.0;
+  }
+
+  rate = (double)hits / accesses;
+  mean = (double)accesses / SAMPLE_GROUPS;
+  for (uint32_t g = 0; g < SAMPLE_GROUPS; g++) {
+    double residual = (smp->hits[g] - rate * smp->accesses[g]) / mean;
+    sum += residual * residual;
+  }
+  return SAMPLE_T95 * sqrt((1.0 - (double)smp->sampled / smp->sets) * sum /
+                           (SAMPLE_GROUPS * (SAMPLE_GROUPS - 1)));
+}
+
+/**
+ * Parses a configuration file line
+ * "size mapping org [ways] [policy] [latency] [write policy] [block size]
+ * [prefetcher] [victim blocks] [3c|none] [sample]".
+ * Returns 1 for blank and comment lines, -1 if the line is malformed.
+*/
+static int parse_config_line(const char *line, cache_config_t *config, uint32_t *latency)
+{
+  char size[32], mapping[8], org[8], policy[16] = "fifo", write[16] = "wb";
+  char prefetch[16] = "none", classify[8] = "none";
+  unsigned int assoc = 4;
+  unsigned int cycles = 0;
+  unsigned int block = DEFAULT_BLOCK_SIZE;
+  unsigned int victim = 0;
+  unsigned int sample = 0;
+
+  /* Skip blank and comment lines */
+  if (sscanf(line, "%31s", size) != 1 || size[0] == '#') {
+    return 1;
+  }
+  if (sscanf(line, "%31s %7s %7s %u %15s %u %15s %u %15s %u %7s %u", size, mapping, org,
+             &assoc, policy, &cycles, write, &block, prefetch, &victim, classify,
+             &sample) < 3) {
+    printf("Malformed configuration: %s", line);
+    return -1;
+  }
+  if (parse_cache_config(config, size, mapping, org, assoc) ||
+      parse_cache_policy(&config->policy, policy) ||
+      parse_write_policy(&config->write, write) ||
+      parse_prefetcher(&config->prefetch, prefetch)) {
+    return -1;
+  }
+  if (strcmp(classify, "3c") != 0 && strcmp(classify, "none") != 0) {
+    printf("Unknown miss classification\n");
+    return -1;
+  }
+  config->block = block;
+  config->victim = victim;
+  config->classify = (strcmp(classify, "3c") == 0);
+  config->sample = sample;
+  if (latency && cycles) {
+    *latency = cycles;
+  }
+  return 0;
+}
+
+/* Worker threads of a pool. gate is held while they are started, every
+ * worker passes it before its first round and leaves at once if not all
+ * of them could be started, so none waits for a missing one.
+ */
+typedef struct workers_t {
+  pthread_t *threads;
+  uint32_t count;
+  pthread_mutex_t gate;
+  bool failed;
+} workers_t;
+
+/* Starts count threads running start, thread t on arg + t * stride.
+ * Returns -1 after joining the started ones if any could not be started.
+ */
+static int workers_start(workers_t *workers, uint32_t count, void *(*start)(void *),
+                         void *arg, size_t stride)
+{
+  workers->threads = malloc(count * sizeof(pthread_t));
+  if (!workers->threads) {
+    printf("Failed to allocate memory for the worker threads\n");
+    return -1;
+  }
+  workers->count = count;
+  workers->failed = false;
+  pthread_mutex_init(&workers->gate, NULL);
+  pthread_mutex_lock(&workers->gate);
+
+  for (uint32_t t = 0; t < count; t++) {
+    if (pthread_create(&workers->threads[t], NULL, start, (uint8_t *)arg + t * stride)) {
+      printf("Failed to start the worker threads\n");
+      workers->failed = true;
+      pthread_mutex_unlock(&workers->gate);
+      while (t--) {
+        pthread_join(workers->threads[t], NULL);
+      }
+      pthread_mutex_destroy(&workers->gate);
+      free(workers->threads);
+      workers->threads = NULL;
+      return -1;
+    }
+  }
+
+  pthread_mutex_unlock(&workers->gate);
+  return 0;
+}
+
+/* First call of every worker, false if the pool could not be started */
+static bool workers_enter(workers_t *workers)
+{
+  pthread_mutex_lock(&workers->gate);
+  pthread_mutex_unlock(&workers->gate);
+  return !workers->failed;
+}
+
+static void workers_join(workers_t *workers)
+{
+  for (uint32_t t = 0; t < workers->count; t++) {
+    pthread_join(workers->threads[t], NULL);
+  }
+  pthread_mutex_destroy(&workers->gate);
+  free(workers->threads);
+  workers->threads = NULL;
+}
+
+/* Number of batches the sweep reads ahead while the workers simulate */
+#define SWEEP_CHUNK 64
+
+/* State shared by the sweep workers. The reader fills one chunk while
+ * the workers simulate the other, two barriers per chunk hand them over.
+ */
+typedef struct sweep_t {
+  cache_sim_t *sims;
+  size_t count;
+  access_batch_t *chunk[2];
+  size_t chunk_len[2];
+  int cur;
+  bool done;
+  atomic_size_t next;
+  pthread_barrier_t ready;
+  pthread_barrier_t finished;
+  workers_t workers;
+} sweep_t;
+
+static void *sweep_worker(void *arg)
+{
+  sweep_t *sweep = arg;
+
+  if (!workers_enter(&sweep->workers)) {
+    return NULL;
+  }
+
+  while (1) {
+    pthread_barrier_wait(&sweep->ready);
+    if (sweep->done) {
+      break;
+    }
+
+    /* Configurations are handed out one at a time, a configuration
+     * stays on one thread for the whole chunk
+     */
+    const access_batch_t *chunk = sweep->chunk[sweep->cur];
+    size_t chunk_len = sweep->chunk_len[sweep->cur];
+    size_t i;
+    while ((i = atomic_fetch_add(&sweep->next, 1)) < sweep->count) {
+      for (size_t b = 0; b < chunk_len; b++) {
+        cache_sim_run_batch(&sweep->sims[i], &chunk[b]);
+      }
+    }
+
+    pthread_barrier_wait(&sweep->finished);
+  }
+
+  return NULL;
+}
+
+static size_t sweep_read_chunk(trace_t *trace, access_batch_t *chunk)
+{
+  size_t n = 0;
+
+  while (n < SWEEP_CHUNK && trace_read_batch(trace, &chunk[n]) > 0) {
+    n++;
+  }
+  return n;
+}
+
+/* Runs every configuration over the trace on a pool of worker threads */
+static int sweep_parallel(cache_sim_t *sims, size_t count, trace_t *trace,
+                          uint32_t threads)
+{
+  sweep_t sweep;
+
+  memset(&sweep, 0, sizeof(sweep));
+  sweep.sims = sims;
+  sweep.count = count;
+  sweep.chunk[0] = malloc(2 * SWEEP_CHUNK * sizeof(access_batch_t));
+  if (!sweep.chunk[0]) {
+    printf("Failed to allocate memory for the sweep\n");
+    return -1;
+  }
+  sweep.chunk[1] = sweep.chunk[0] + SWEEP_CHUNK;
+
+  pthread_barrier_init(&sweep.ready, NULL, threads + 1);
+  pthread_barrier_init(&sweep.finished, NULL, threads + 1);
+  if (workers_start(&sweep.workers, threads, sweep_worker, &sweep, 0)) {
+    pthread_barrier_destroy(&sweep.ready);
+    pthread_barrier_destroy(&sweep.finished);
+    free(sweep.chunk[0]);
+    return -1;
+  }
+
+  sweep.chunk_len[0] = sweep_read_chunk(trace, sweep.chunk[0]);
+  while (1) {
+    sweep.done = (sweep.chunk_len[sweep.cur] == 0);
+    atomic_store(&sweep.next, 0);
+    pthread_barrier_wait(&sweep.ready);
+    if (sweep.done) {
+      break;
+    }
+
+    /* Read ahead while the workers simulate the current chunk */
+    sweep.chunk_len[!sweep.cur] = sweep_read_chunk(trace, sweep.chunk[!sweep.cur]);
+
+    pthread_barrier_wait(&sweep.finished);
+    sweep.cur = !sweep.cur;
+  }
+
+  workers_join(&sweep.workers);
+  pthread_barrier_destroy(&sweep.ready);
+  pthread_barrier_destroy(&sweep.finished);
+  free(sweep.chunk[0]);
+
+  return 0;
+}
+
+/* Local state of a block in a chunk of a direct mapped simulation:
+ *  DM_DIRTY:          the block last placed was written
+ *  DM_REPLACED:       the block the first access placed was replaced
+ *  DM_REPLACED_DIRTY: it was written in the chunk before that
+ */
+#define DM_DIRTY 1
+#define DM_REPLACED 2
+#define DM_REPLACED_DIRTY 4
+
+/* A chunk of a chunk parallel direct mapped simulation, its batches and
+ * what simulating it from an empty cache left to resolve: the first and
+ * last tag of every block touched (stamp is epoch), in touched order.
+ * Blocks of the data cache of a split cache follow the instruction cache.
+ */
+typedef struct dm_chunk_t {
+  access_batch_t *batches[2];
+  size_t len[2];
+  uint64_t *first;
+  uint64_t *last;
+  uint32_t *stamp;
+  uint8_t *flags;
+  uint32_t *touched;
+  size_t touched_len;
+  uint32_t epoch;
+  uint64_t hits;
+  uint64_t evicts[2];
+  uint64_t writebacks[2];
+} dm_chunk_t;
+
+typedef struct dm_parallel_t {
+  const cache_sim_t *sim;
+  dm_chunk_t *chunks;
+  uint32_t count;
+  int cur;
+  bool done;
+  atomic_uint next;
+  pthread_barrier_t ready;
+  pthread_barrier_t finished;
+  workers_t workers;
+} dm_parallel_t;
+
+/* Simulates a chunk from an empty cache. Only write-allocate caches, so
+ * every access places its block and all but the first access of every
+ * block hit or miss as in the serial simulation.
+ */
+static void dm_chunk_simulate(const cache_sim_t *sim, dm_chunk_t *chunk, int cur)
+{
+  const uint32_t offset = sim->bits.offset;
+  const uint32_t index_mask = MASK(sim->bits.index);
+  const uint32_t tag_shift = sim->bits.index + sim->bits.offset;
+  const uint64_t tag_mask = MASK(sim->bits.tag);
+  const bool split = (sim->config.org == sc);
+  const uint8_t write_dirty = (sim->config.write == wp_wb) ? DM_DIRTY : 0;
+  uint32_t epoch;
+  size_t n = 0;
+
+  if (++chunk->epoch == 0) {
+    memset(chunk->stamp, 0, (size_t)sim->length * (split ? 2 : 1) * sizeof(uint32_t));
+    chunk->epoch = 1;
+  }
+  epoch = chunk->epoch;
+  chunk->hits = 0;
+  memset(chunk->evicts, 0, sizeof(chunk->evicts));
+  memset(chunk->writebacks, 0, sizeof(chunk->writebacks));
+
+  for (size_t b = 0; b < chunk->len[cur]; b++) {
+    const access_batch_t *batch = &chunk->batches[cur][b];
+
+    for (size_t i = 0; i < batch->len; i++) {
+      int type = split ? batch->type[i] : 0;
+      size_t slot = ((batch->address[i] >> offset) & index_mask) + type * (size_t)sim->length;
+      uint64_t tag = (batch->address[i] >> tag_shift) & tag_mask;
+      uint8_t dirty = batch->write[i] ? write_dirty : 0;
+
+      if (chunk->stamp[slot] != epoch) {
+        /* Resolved against the state the previous chunks left */
+        chunk->stamp[slot] = epoch;
+        chunk->first[slot] = tag;
+        chunk->last[slot] = tag;
+        chunk->flags[slot] = dirty;
+        chunk->touched[n++] = slot;
+      } else if (chunk->last[slot] == tag) {
+        chunk->hits++;
+        chunk->flags[slot] |= dirty;
+      } else {
+        uint8_t flags = chunk->flags[slot];
+
+        chunk->evicts[type]++;
+        chunk->writebacks[type] += flags & DM_DIRTY;
+        if (!(flags & DM_REPLACED)) {
+          flags |= DM_REPLACED | ((flags & DM_DIRTY) ? DM_REPLACED_DIRTY : 0);
+        }
+        chunk->flags[slot] = (flags & ~DM_DIRTY) | dirty;
+        chunk->last[slot] = tag;
+      }
+    }
+  }
+  chunk->touched_len = n;
+}
+
+/* Resolves the first access of every block of a chunk against the cache,
+ * which holds the state of all chunks before it, and moves the cache to
+ * the state after the chunk
+ */
+static void dm_chunk_resolve(cache_sim_t *sim, const dm_chunk_t *chunk)
+{
+  sim->stats.hits += chunk->hits;
+  for (int c = 0; c < ((sim->config.org == sc) ? 2 : 1); c++) {
+    sim->cache[c].evicts += chunk->evicts[c];
+    sim->cache[c].writebacks += chunk->writebacks[c];
+  }
+
+  for (size_t k = 0; k < chunk->touched_len; k++) {
+    uint32_t slot = chunk->touched[k];
+    cache_t *cache = &sim->cache[slot / sim->length];
+    uint32_t index = slot % sim->length;
+    uint8_t flags = chunk->flags[slot];
+    bool valid = BLOCK_VALID(cache, index);
+    bool was_dirty = valid && cache->dirty && bit_test(cache->dirty, index);
+    bool dirty = flags & DM_DIRTY;
+
+    if (valid && tag_matches(cache, index, chunk->first[slot])) {
+      sim->stats.hits++;
+      /* The chunk did not know the block it hit was dirty */
+      if (was_dirty && (flags & DM_REPLACED)) {
+        cache->writebacks += !(flags & DM_REPLACED_DIRTY);
+      } else if (was_dirty) {
+        dirty = true;
+      }
+    } else if (valid) {
+      cache->evicts++;
+      cache->writebacks += was_dirty;
+    }
+
+    SET_BLOCK_VALID(cache, index);
+    store_tag(cache, index, chunk->last[slot]);
+    if (cache->dirty) {
+      bit_assign(cache->dirty, index, dirty);
+    }
+  }
+}
+
+static void *dm_parallel_worker(void *arg)
+{
+  dm_parallel_t *par = arg;
+
+  if (!workers_enter(&par->workers)) {
+    return NULL;
+  }
+
+  while (1) {
+    pthread_barrier_wait(&par->ready);
+    if (par->done) {
+      break;
+    }
+
+    unsigned int i;
+    while ((i = atomic_fetch_add(&par->next, 1)) < par->count) {
+      dm_chunk_simulate(par->sim, &par->chunks[i], par->cur);
+    }
+
+    pthread_barrier_wait(&par->finished);
+  }
+
+  return NULL;
+}
+
+/* Reads the next chunk of every worker, returns false at the end */
+static bool dm_parallel_read(dm_parallel_t *par, trace_t *trace, int buf)
+{
+  bool any = false;
+
+  for (uint32_t i = 0; i < par->count; i++) {
+    par->chunks[i].len[buf] = sweep_read_chunk(trace, par->chunks[i].batches[buf]);
+    any |= (par->chunks[i].len[buf] != 0);
+  }
+  return any;
+}
+
+static void dm_parallel_free(dm_parallel_t *par)
+{
+  for (uint32_t i = 0; i < par->count; i++) {
+    dm_chunk_t *chunk = &par->chunks[i];
+
+    free(chunk->batches[0]);
+    free(chunk->first);
+    free(chunk->last);
+    free(chunk->stamp);
+    free(chunk->flags);
+    free(chunk->touched);
+  }
+  free(par->chunks);
+}
+
+/**
+ * Chunk parallel simulation of a direct mapped write-allocate cache. Every
+ * round the threads simulate consecutive chunks of the trace at once and
+ * the reader resolves them in trace order, while it reads the next round.
+ * Hits and all other statistics are identical to a serial run.
+*/
+static int dm_parallel(cache_sim_t *sim, trace_t *trace, uint32_t threads)
+{
+  size_t blocks = (size_t)sim->length * ((sim->config.org == sc) ? 2 : 1);
+  dm_parallel_t par;
+
+  memset(&par, 0, sizeof(par));
+  par.sim = sim;
+  par.count = threads;
+  par.chunks = calloc(threads, sizeof(dm_chunk_t));
+  if (!par.chunks) {
+    printf("Failed to allocate memory for the chunks\n");
+    return -1;
+  }
+  for (uint32_t i = 0; i < threads; i++) {
+    dm_chunk_t *chunk = &par.chunks[i];
+
+    chunk->batches[0] = malloc(2 * SWEEP_CHUNK * sizeof(access_batch_t));
+    chunk->first = malloc(blocks * sizeof(uint64_t));
+    chunk->last = malloc(blocks * sizeof(uint64_t));
+    chunk->stamp = calloc(blocks, sizeof(uint32_t));
+    chunk->flags = malloc(blocks);
+    chunk->touched = malloc(blocks * sizeof(uint32_t));
+    if (!chunk->batches[0] || !chunk->first || !chunk->last || !chunk->stamp ||
+        !chunk->flags || !chunk->touched) {
+      printf("Failed to allocate memory for the chunks\n");
+      dm_parallel_free(&par);
+      return -1;
+    }
+    chunk->batches[1] = chunk->batches[0] + SWEEP_CHUNK;
+  }
+
+  pthread_barrier_init(&par.ready, NULL, threads + 1);
+  pthread_barrier_init(&par.finished, NULL, threads + 1);
+  if (workers_start(&par.workers, threads, dm_parallel_worker, &par, 0)) {
+    pthread_barrier_destroy(&par.ready);
+    pthread_barrier_destroy(&par.finished);
+    dm_parallel_free(&par);
+    return -1;
+  }
+
+  par.done = !dm_parallel_read(&par, trace, 0);
+  while (1) {
+    bool more;
+
+    atomic_store(&par.next, 0);
+    pthread_barrier_wait(&par.ready);
+    if (par.done) {
+      break;
+    }
+
+    /* Read ahead while the workers simulate the current round */
+    more = dm_parallel_read(&par, trace, !par.cur);
+
+    pthread_barrier_wait(&par.finished);
+    for (uint32_t i = 0; i < threads; i++) {
+      for (size_t b = 0; b < par.chunks[i].len[par.cur]; b++) {
+        sim->stats.accesses += par.chunks[i].batches[par.cur][b].len;
+        sim->stats.writes += par.chunks[i].batches[par.cur][b].writes;
+      }
+      dm_chunk_resolve(sim, &par.chunks[i]);
+    }
+    par.cur = !par.cur;
+    par.done = !more;
+  }
+
+  workers_join(&par.workers);
+  pthread_barrier_destroy(&par.ready);
+  pthread_barrier_destroy(&par.finished);
+  dm_parallel_free(&par);
+
+  cache_sim_update_stats(sim);
+  return 0;
+}
+
+/* Blocks of a partition are a multiple of this, so no word of the valid,
+ * dirty and replacement bitmaps is shared by two partitions
+ */
+#define PARTITION_BLOCKS 64
+
+/* State shared by the views of a set partitioned simulation. owner maps
+ * every unit of sets to its view. The reader fills one queue of every
+ * view while the views simulate the other, two barriers per round hand
+ * them over.
+ */
+typedef struct partition_pool_t {
+  cache_sim_t *views;
+  partition_t *partitions;
+  uint32_t count;
+  uint32_t *owner;
+  uint32_t unit_shift;
+  int cur;
+  bool done;
+  pthread_barrier_t ready;
+  pthread_barrier_t finished;
+  workers_t workers;
+} partition_pool_t;
+
+static void *partition_worker(void *arg)
+{
+  cache_sim_t *view = arg;
+  partition_t *part = view->partition;
+  partition_pool_t *pool = part->pool;
+
+  if (!workers_enter(&pool->workers)) {
+    return NULL;
+  }
+
+  while (1) {
+    pthread_barrier_wait(&pool->ready);
+    if (pool->done) {
+      break;
+    }
+
+    for (size_t b = 0; b * TRACE_BATCH < part->queued[pool->cur]; b++) {
+      cache_sim_run_batch(view, &part->queue[pool->cur][b]);
+    }
+
+    pthread_barrier_wait(&pool->finished);
+  }
+
+  return NULL;
+}
+
+/* Routes trace batches to the queues of the views owning their sets until
+ * the trace ends or a queue could not take another batch, returns whether
+ * anything was queued
+ */
+static bool partition_route(partition_pool_t *pool, trace_t *trace,
+                            access_batch_t *batch, int buf)
+{
+  const cache_bits_t bits = pool->views[0].bits;
+  const uint32_t index_mask = MASK(bits.index);
+  size_t most = 0;
+  bool any = false;
+
+  for (uint32_t p = 0; p < pool->count; p++) {
+    pool->partitions[p].queued[buf] = 0;
+  }
+
+  while (most + TRACE_BATCH <= PARTITION_QUEUE * TRACE_BATCH &&
+         trace_read_batch(trace, batch) > 0) {
+    for (size_t i = 0; i < batch->len; i++) {
+      uint32_t index = (batch->address[i] >> bits.offset) & index_mask;
+      partition_t *part = &pool->partitions[pool->owner[index >> pool->unit_shift]];
+      size_t k = part->queued[buf]++;
+      access_batch_t *own = &part->queue[buf][k / TRACE_BATCH];
+      size_t slot = k % TRACE_BATCH;
+
+      if (slot == 0) {
+        own->writes = 0;
+      }
+      own->address[slot] = batch->address[i];
+      own->type[slot] = batch->type[i];
+      own->write[slot] = batch->write[i];
+      own->writes += batch->write[i];
+      own->len = slot + 1;
+    }
+    for (uint32_t p = 0; p < pool->count; p++) {
+      if (pool->partitions[p].queued[buf] > most) {
+        most = pool->partitions[p].queued[buf];
+      }
+    }
+    any = true;
+  }
+  return any;
+}
+
+static void partition_free(partition_pool_t *pool)
+{
+  for (uint32_t p = 0; p < pool->count; p++) {
+    free(pool->views[p].ids);
+    free(pool->partitions[p].queue[0]);
+  }
+  free(pool->views);
+  free(pool->partitions);
+  free(pool->owner);
+}
+
+/**
+ * Simulates a whole trace with one configuration. With more than one
+ * thread the sets are split into ranges and every range is simulated on
+ * its own thread by a view of the configuration. The reader routes every
+ * access to the view owning its set. Views share the cache arrays but
+ * count on their own, sets never interact, so the result is identical to
+ * a serial run. Fully associative caches, random replacement and the per
+ * access kernel keep state across sets and run serially.
+*/
+int cache_sim_run_trace(cache_sim_t *sim, trace_t *trace, uint32_t threads)
+{
+  const int caches = (sim->config.org == sc) ? 2 : 1;
+  uint32_t sets = sim->length / sim->ways;
+  uint32_t group = (sim->ways < PARTITION_BLOCKS) ? PARTITION_BLOCKS / sim->ways : 1;
+  uint32_t units = sets / group;
+  uint32_t parts = (threads < units) ? threads : units;
+  partition_pool_t pool;
+  access_batch_t *batch;
+
+  /* Direct mapped caches with too few sets to go round split the trace */
+  if (threads > 1 && parts < threads && sim->config.mapping == dm &&
+      sim->kernel != kernel_instrumented && !sim->sampler &&
+      (sim->config.write == wp_wb || sim->config.write == wp_wt)) {
+    return dm_parallel(sim, trace, threads);
+  }
+
+  batch = malloc(sizeof(access_batch_t));
+  if (!batch) {
+    printf("Failed to allocate memory for the access batch\n");
+    return -1;
+  }
+
+  if (parts < 2 || sim->config.mapping == fa || sim->config.policy == rp_random ||
+      sim->kernel == kernel_instrumented || sim->sampler) {
+    while (trace_read_batch(trace, batch) > 0) {
+      cache_sim_run_batch(sim, batch);
+    }
+    free(batch);
+    return 0;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pool.views = calloc(parts, sizeof(cache_sim_t));
+  pool.partitions = calloc(parts, sizeof(partition_t));
+  pool.owner = malloc(units * sizeof(uint32_t));
+  if (!pool.views || !pool.partitions || !pool.owner) {
+    printf("Failed to allocate memory for the partitions\n");
+    partition_free(&pool);
+    free(batch);
+    return -1;
+  }
+  pool.count = parts;
+  pool.unit_shift = countBits(group);
+
+  /* View p owns the units u with u * parts / units == p */
+  for (uint32_t u = 0; u < units; u++) {
+    pool.owner[u] = (uint32_t)((uint64_t)u * parts / units);
+  }
+
+  /* Views must not allocate the high tag bits on their own */
+  for (int c = 0; c < caches; c++) {
+    cache_t *cache = &sim->cache[c];
+
+    if (!cache->tag_hi) {
+      cache->tag_hi = (uint16_t *)calloc((size_t)cache->length, sizeof(uint16_t));
+      if (!cache->tag_hi) {
+        printf("Failed to allocate memory for the partitions\n");
+        partition_free(&pool);
+        free(batch);
+        return -1;
+      }
+    }
+  }
+
+  for (uint32_t p = 0; p < parts; p++) {
+    cache_sim_t *view = &pool.views[p];
+    partition_t *part = &pool.partitions[p];
+
+    *view = *sim;
+    memset(&view->stats, 0, sizeof(view->stats));
+    for (int c = 0; c < caches; c++) {
+      view->cache[c].evicts = 0;
+      view->cache[c].writebacks = 0;
+      view->cache[c].write_around = 0;
+    }
+    view->caches[instruction] = &view->cache[(caches == 2) ? instruction : 0];
+    view->caches[data] = &view->cache[(caches == 2) ? data : 0];
+    view->ids = malloc(sizeof(access_ids_t));
+    part->queue[0] = malloc(2 * PARTITION_QUEUE * sizeof(access_batch_t));
+    if (!view->ids || !part->queue[0]) {
+      printf("Failed to allocate memory for the partitions\n");
+      partition_free(&pool);
+      free(batch);
+      return -1;
+    }
+    part->queue[1] = part->queue[0] + PARTITION_QUEUE;
+    part->pool = &pool;
+    view->partition = part;
+  }
+
+  pthread_barrier_init(&pool.ready, NULL, parts + 1);
+  pthread_barrier_init(&pool.finished, NULL, parts + 1);
+  if (workers_start(&pool.workers, parts, partition_worker, pool.views,
+                    sizeof(cache_sim_t))) {
+    pthread_barrier_destroy(&pool.ready);
+    pthread_barrier_destroy(&pool.finished);
+    partition_free(&pool);
+    free(batch);
+    return -1;
+  }
+
+  pool.done = !partition_route(&pool, trace, batch, 0);
+  while (1) {
+    bool more;
+
+    pthread_barrier_wait(&pool.ready);
+    if (pool.done) {
+      break;
+    }
+
+    /* Route the next accesses while the views simulate these */
+    more = partition_route(&pool, trace, batch, !pool.cur);
+
+    pthread_barrier_wait(&pool.finished);
+    pool.cur = !pool.cur;
+    pool.done = !more;
+  }
+
+  workers_join(&pool.workers);
+  pthread_barrier_destroy(&pool.ready);
+  pthread_barrier_destroy(&pool.finished);
+
+  /* Every access went to exactly one view, cache counters are their own */
+  for (uint32_t p = 0; p < parts; p++) {
+    sim->stats.accesses += pool.views[p].stats.accesses;
+    sim->stats.writes += pool.views[p].stats.writes;
+    sim->stats.hits += pool.views[p].stats.hits;
+    for (int c = 0; c < caches; c++) {
+      sim->cache[c].evicts += pool.views[p].cache[c].evicts;
+      sim->cache[c].writebacks += pool.views[p].cache[c].writebacks;
+      sim->cache[c].write_around += pool.views[p].cache[c].write_around;
+    }
+  }
+  cache_sim_update_stats(sim);
+
+  partition_free(&pool);
+  free(batch);
+  return 0;
+}
+
+/* Lists the arrays of a cache in checkpoint order and their sizes in
+ * bytes, absent arrays are NULL
+ */
+static void cache_arrays(cache_t *cache, void **arrays[CHECKPOINT_ARRAYS],
+                         size_t sizes[CHECKPOINT_ARRAYS])
+{
+  size_t words = ((size_t)cache->length + 63) / 64;
+
+  arrays[0] = (void **)&cache->set;
+  sizes[0] = (size_t)cache->sets * sizeof(cache_set_t);
+  arrays[1] = (void **)&cache->tag;
+  sizes[1] = (size_t)cache->length * sizeof(uint32_t);
+  arrays[2] = (void **)&cache->tag_hi;
+  sizes[2] = (size_t)cache->length * sizeof(uint16_t);
+  arrays[3] = (void **)&cache->valid;
+  sizes[3] = words * sizeof(uint64_t);
+  arrays[4] = (void **)&cache->hash;
+  sizes[4] = (size_t)cache->sets * cache->hash_size * sizeof(uint32_t);
+  arrays[5] = (void **)&cache->meta;
+  sizes[5] = ((cache->policy == rp_lru) ? 2 : 1) * (size_t)cache->length * sizeof(uint32_t);
+  arrays[6] = (void **)&cache->set_state;
+  sizes[6] = (size_t)cache->sets * sizeof(uint32_t);
+  arrays[7] = (void **)&cache->bits;
+  sizes[7] = words * sizeof(uint64_t);
+  arrays[8] = (void **)&cache->dirty;
+  sizes[8] = words * sizeof(uint64_t);
+}
+
+static inline size_t checkpoint_align(size_t n)
+{
+  return (n + CHECKPOINT_ALIGN - 1) & ~(size_t)(CHECKPOINT_ALIGN - 1);
+}
+
+/* Writes len bytes and pads them with zeros to the next CHECKPOINT_ALIGN */
+static int checkpoint_write(FILE *out, const void *data, size_t len)
+{
+  static const uint8_t zeros[CHECKPOINT_ALIGN];
+
+  if (fwrite(data, 1, len, out) != len) {
+    return -1;
+  }
+  len = checkpoint_align(len) - len;
+  return (fwrite(zeros, 1, len, out) == len) ? 0 : -1;
+}
+
+/* Only the caches themselves are checkpointed */
+static int checkpoint_supported(const cache_config_t *config)
+{
+  if (config->prefetch != pf_none || config->victim || config->classify ||
+      config->sample > 1) {
+    printf("Checkpoints do not hold prefetchers, victim caches, "
+           "miss classification or set sampling\n");
+    return 0;
+  }
+  return 1;
+}
+
+static bool config_matches(const cache_config_t *a, const cache_config_t *b)
+{
+  return a->size == b->size && a->mapping == b->mapping && a->org == b->org &&
+         a->assoc == b->assoc && a->policy == b->policy && a->write == b->write &&
+         a->block == b->block;
+}
+
+/**
+ * Writes the state of every cache of a simulation and its statistics to a
+ * checkpoint at path. The trace offset it records is the number of
+ * accesses simulated so far.
+*/
+int cache_sim_save(const cache_sim_t *sim, const char *path)
+{
+  const int caches = (sim->config.org == sc) ? 2 : 1;
+  checkpoint_header_t header;
+  FILE *out;
+  int err;
+
+  if (!checkpoint_supported(&sim->config)) {
+    return -1;
+  }
+  out = fopen(path, "wb");
+  if (!out) {
+    printf("Unable to create the checkpoint file\n");
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.caches = caches;
+  header.config = sim->config;
+  header.stats = sim->stats;
+  header.offset = sim->stats.accesses;
+  err = checkpoint_write(out, &header, sizeof(header));
+
+  for (int c = 0; c < caches && !err; c++) {
+    cache_t *cache = (cache_t *)&sim->cache[c];
+    checkpoint_cache_t state;
+    void **arrays[CHECKPOINT_ARRAYS];
+    size_t sizes[CHECKPOINT_ARRAYS];
+
+    memset(&state, 0, sizeof(state));
+    state.tag_hi = (cache->tag_hi != NULL);
+    state.rng = cache->rng;
+    state.victim = cache->victim;
+    state.writebacks = cache->writebacks;
+    state.write_around = cache->write_around;
+    state.evicts = cache->evicts;
+    err = checkpoint_write(out, &state, sizeof(state));
+
+    cache_arrays(cache, arrays, sizes);
+    for (int i = 0; i < CHECKPOINT_ARRAYS && !err; i++) {
+      if (*arrays[i]) {
+        err = checkpoint_write(out, *arrays[i], sizes[i]);
+      }
+    }
+  }
+
+  if (fclose(out) || err) {
+    printf("Failed to write the checkpoint file\n");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Restores the caches and statistics of a simulation initialized with the
+ * configuration of the checkpoint at path, and returns the trace offset
+ * to continue from in offset. The checkpoint is mapped copy on write and
+ * the caches use its arrays in place, so restoring costs no more than
+ * touching the blocks the rest of the trace uses.
+*/
+int cache_sim_restore(cache_sim_t *sim, const char *path, uint64_t *offset)
+{
+  const int caches = (sim->config.org == sc) ? 2 : 1;
+  checkpoint_header_t header;
+  checkpoint_cache_t state[2];
+  struct stat st;
+  uint8_t *map;
+  size_t size, pos;
+  int fd;
+
+  if (!checkpoint_supported(&sim->config)) {
+    return -1;
+  }
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Unable to open the checkpoint file\n");
+    return -1;
+  }
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(header)) {
+    printf("Not a cache checkpoint\n");
+    close(fd);
+    return -1;
+  }
+  size = st.st_size;
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("Unable to map the checkpoint file\n");
+    return -1;
+  }
+
+  memcpy(&header, map, sizeof(header));
+  if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CHECKPOINT_VERSION) {
+    printf("Not a cache checkpoint or unsupported version\n");
+    munmap(map, size);
+    return -1;
+  }
+  if (header.caches != (uint32_t)caches || !config_matches(&header.config, &sim->config)) {
+    printf("The checkpoint was taken with a different cache configuration\n");
+    munmap(map, size);
+    return -1;
+  }
+
+  /* Check that everything is there before any cache is changed */
+  pos = checkpoint_align(sizeof(header));
+  for (int c = 0; c < caches; c++) {
+    void **arrays[CHECKPOINT_ARRAYS];
+    size_t sizes[CHECKPOINT_ARRAYS];
+
+    if (pos + sizeof(checkpoint_cache_t) > size) {
+      pos = size + 1;
+      break;
+    }
+    memcpy(&state[c], map + pos, sizeof(checkpoint_cache_t));
+    pos += checkpoint_align(sizeof(checkpoint_cache_t));
+    cache_arrays(&sim->cache[c], arrays, sizes);
+    for (int i = 0; i < CHECKPOINT_ARRAYS; i++) {
+      if (*arrays[i] || (arrays[i] == (void **)&sim->cache[c].tag_hi && state[c].tag_hi)) {
+        pos += checkpoint_align(sizes[i]);
+      }
+    }
+  }
+  if (pos > size) {
+    printf("Truncated checkpoint\n");
+    munmap(map, size);
+    return -1;
+  }
+
+  pos = checkpoint_align(sizeof(header));
+  for (int c = 0; c < caches; c++) {
+    cache_t *cache = &sim->cache[c];
+    void **arrays[CHECKPOINT_ARRAYS];
+    size_t sizes[CHECKPOINT_ARRAYS];
+
+    pos += checkpoint_align(sizeof(checkpoint_cache_t));
+    cache_arrays(cache, arrays, sizes);
+    for (int i = 0; i < CHECKPOINT_ARRAYS; i++) {
+      if (*arrays[i] || (arrays[i] == (void **)&cache->tag_hi && state[c].tag_hi)) {
+        cache_free(cache, *arrays[i]);
+        *arrays[i] = map + pos;
+        pos += checkpoint_align(sizes[i]);
+      }
+    }
+    cache->map = map;
+    cache->map_size = size;
+    cache->rng = state[c].rng;
+    cache->victim = state[c].victim;
+    cache->writebacks = state[c].writebacks;
+    cache->write_around = state[c].write_around;
+    cache->evicts = state[c].evicts;
+  }
+
+  sim->stats = header.stats;
+  sim->snapshot = map;
+  sim->snapshot_size = size;
+  *offset = header.offset;
+  return 0;
+}
+
+/**
+ * Simulates every configuration listed in config_path, one per line in
+ * the format of parse_config_line(), in a single pass over the trace
+ * and prints one row of statistics per configuration. With more than
+ * one thread the configurations are spread over a pool of workers.
+*/
+int run_sweep(const char *config_path, const char *trace_path, uint32_t threads)
+{
+  cache_config_t *configs = NULL;
+  cache_sim_t *sims;
+  size_t count = 0;
+  size_t capacity = 0;
+  char line[256];
+  FILE *file;
+  trace_t trace;
+  static access_batch_t batch;
+
+  file = fopen(config_path, "r");
+  if (!file) {
+    printf("Unable to open the sweep configuration file\n");
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    cache_config_t config;
+    int ret = parse_config_line(line, &config, NULL);
+
+    if (ret > 0) {
+      continue;
+    }
+    if (ret < 0) {
+      fclose(file);
+      free(configs);
+      return -1;
+    }
+
+    if (count == capacity) {
+      cache_config_t *grown;
+
+      capacity = capacity ? 2 * capacity : 16;
+      grown = realloc(configs, capacity * sizeof(cache_config_t));
+      if (!grown) {
+        printf("Failed to allocate memory for the sweep\n");
+        fclose(file);
+        free(configs);
+        return -1;
+      }
+      configs = grown;
+    }
+    configs[count++] = config;
+  }
+  fclose(file);
+
+  sims = calloc(count ? count : 1, sizeof(cache_sim_t));
+  if (!sims) {
+    printf("Failed to allocate memory for the sweep\n");
+    free(configs);
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (cache_sim_init(&sims[i], &configs[i])) {
+      while (i--) {
+        cache_sim_deinit(&sims[i]);
+      }
+      free(sims);
+      free(configs);
+      return -1;
+    }
+  }
+
+  if (trace_open(&trace, trace_path)) {
+    printf("Unable to open the trace file\n");
+    for (size_t i = 0; i < count; i++) {
+      cache_sim_deinit(&sims[i]);
+    }
+    free(sims);
+    free(configs);
+    return -1;
+  }
+
+  /* Every configuration is driven from the same parsed batch */
+  if (threads > count) {
+    threads = count;
+  }
+  if (threads > 1) {
+    if (sweep_parallel(sims, count, &trace, threads)) {
+      trace_close(&trace);
+      for (size_t i = 0; i < count; i++) {
+        cache_sim_deinit(&sims[i]);
+      }
+      free(sims);
+      free(configs);
+      return -1;
+    }
+  } else {
+    while (trace_read_batch(&trace, &batch) > 0) {
+      for (size_t i = 0; i < count; i++) {
+        cache_sim_run_batch(&sims[i], &batch);
+      }
+    }
+  }
+  trace_close(&trace);
+
+  printf("%-10s %5s %-7s %-4s %6s %-7s %-6s %-8s %6s %12s %12s %12s %8s %14s %14s %12s %12s"
+         " %12s %12s %12s %12s %6s %8s\n",
+         "Size", "Block", "Mapping", "Org", "Ways", "Policy", "Write", "Prefetch", "Victim",
+         "Accesses", "Hits", "Evicts", "Hit Rate", "Read Bytes", "Write Bytes",
+         "Prefetches", "Useful", "Victim Hits", "Compulsory", "Capacity", "Conflict",
+         "Sample", "+/- 95%");
+  for (size_t i = 0; i < count; i++) {
+    const cache_sim_t *sim = &sims[i];
+
+    printf("%-10u %5u %-7s %-4s %6u %-7s %-6s %-8s %6u %12" PRIu64 " %12" PRIu64
+           " %12" PRIu64 " %8.4f %14" PRIu64 " %14" PRIu64 " %12" PRIu64 " %12" PRIu64
+           " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %6u %8.4f\n",
+           sim->config.size, sim->config.block, mapping_name[sim->config.mapping],
+           org_name[sim->config.org], sim->ways, policy_name[sim->config.policy],
+           write_policy_name[sim->config.write], prefetch_name[sim->config.prefetch],
+           sim->config.victim, sim->stats.accesses, sim->stats.hits, sim->stats.evicts,
+           (double)sim->stats.hits / sim->stats.accesses,
+           sim->stats.read_bytes, sim->stats.write_bytes,
+           sim->stats.prefetches, sim->stats.useful_prefetches, sim->stats.victim_hits,
+           sim->stats.compulsory_misses, sim->stats.capacity_misses,
+           sim->stats.conflict_misses, sim->sampler ? sim->sampler->rate : 1,
+           cache_sim_hit_rate_ci(sim));
+    cache_sim_deinit(&sims[i]);
+  }
+
+  free(sims);
+  free(configs);
+  return 0;
+}
+
+/* Hit latencies in cycles used when the configuration gives none */
+static const uint32_t default_latency[MAX_LEVELS] = { 4, 12, 40, 80 };
+#define DEFAULT_MEMORY_LATENCY 200
+
+static const char *inclusion_name[] = { "nine", "inclusive", "exclusive" };
+
+/**
+ * Reads a hierarchy configuration: one "size mapping org [ways] [policy]
+ * [latency]" line per level from the core outwards, and optionally
+ * "inclusion nine|inclusive|exclusive" and "memory <latency>" lines.
+*/
+int hierarchy_init(hierarchy_t *hierarchy, const char *config_path)
+{
+  cache_config_t configs[MAX_LEVELS];
+  char line[256];
+  FILE *file;
+
+  memset(hierarchy, 0, sizeof(hierarchy_t));
+  hierarchy->inclusion = nine;
+  hierarchy->memory_latency = DEFAULT_MEMORY_LATENCY;
+  memcpy(hierarchy->latency, default_latency, sizeof(default_latency));
+
+  file = fopen(config_path, "r");
+  if (!file) {
+    printf("Unable to open the hierarchy configuration file\n");
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    char key[16], value[16];
+    int ret;
+
+    if (sscanf(line, "%15s %15s", key, value) == 2) {
+      if (strcmp(key, "memory") == 0) {
+        hierarchy->memory_latency = atoi(value);
+        continue;
+      }
+      if (strcmp(key, "inclusion") == 0) {
+        size_t i;
+        for (i = 0; i < 3 && strcmp(value, inclusion_name[i]) != 0; i++);
+        if (i == 3) {
+          printf("Unknown inclusion policy\n");
+          fclose(file);
+          return -1;
+        }
+        hierarchy->inclusion = (inclusion_t)i;
+        continue;
+      }
+    }
+
+    if (hierarchy->levels == MAX_LEVELS) {
+      printf("At most %d cache levels are supported\n", MAX_LEVELS);
+      fclose(file);
+      return -1;
+    }
+    ret = parse_config_line(line, &configs[hierarchy->levels],
+                            &hierarchy->latency[hierarchy->levels]);
+    if (ret < 0) {
+      fclose(file);
+      return -1;
+    }
+    if (ret == 0) {
+      hierarchy->levels++;
+    }
+  }
+  fclose(file);
+
+  if (hierarchy->levels == 0) {
+    printf("The hierarchy has no cache levels\n");
+    return -1;
+  }
+
+  /* Blocks move between levels whole, all levels share one block size */
+  for (uint32_t i = 1; i < hierarchy->levels; i++) {
+    if (configs[i].block != configs[0].block) {
+      printf("All cache levels must have the same block size\n");
+      return -1;
+    }
+  }
+  for (uint32_t i = 0; i < hierarchy->levels; i++) {
+    if (configs[i].prefetch != pf_none) {
+      printf("Prefetchers are not modeled in a hierarchy\n");
+      return -1;
+    }
+    if (configs[i].victim || configs[i].classify) {
+      printf("Victim caches and miss classification are not modeled in a hierarchy\n");
+      return -1;
+    }
+  }
+
+  for (uint32_t i = 0; i < hierarchy->levels; i++) {
+    if (cache_sim_init(&hierarchy->level[i], &configs[i])) {
+      while (i--) {
+        cache_sim_deinit(&hierarchy->level[i]);
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void hierarchy_deinit(hierarchy_t *hierarchy)
+{
+  for (uint32_t i = 0; i < hierarchy->levels; i++) {
+    cache_sim_deinit(&hierarchy->level[i]);
+  }
+  hierarchy->levels = 0;
+}
+
+static inline void level_ids(const cache_sim_t *sim, uint64_t address,
+                             uint32_t *index, uint64_t *tag)
+{
+  *index = (address >> sim->bits.offset) & MASK(sim->bits.index);
+  *tag = address >> (sim->bits.index + sim->bits.offset);
+}
+
+/* Block address of a block of a level */
+static inline uint64_t level_address(const cache_sim_t *sim, uint32_t index, uint64_t tag)
+{
+  return ((tag << sim->bits.index) | index) << sim->bits.offset;
+}
+
+/* Invalidates a block evicted from level in every level above it */
+static void back_invalidate(hierarchy_t *hierarchy, uint32_t level, uint64_t address)
+{
+  uint32_t index;
+  uint64_t tag;
+
+  for (uint32_t i = 0; i < level; i++) {
+    cache_sim_t *sim = &hierarchy->level[i];
+
+    level_ids(sim, address, &index, &tag);
+    cache_invalidate(&sim->cache[0], index, tag);
+    if (sim->config.org == sc) {
+      cache_invalidate(&sim->cache[1], index, tag);
+    }
+  }
+}
+
+/* Simulates one access through the levels of the hierarchy */
+void hierarchy_access(hierarchy_t *hierarchy, uint64_t address, access_t type)
+{
+  uint32_t index;
+  uint64_t tag;
+  int hit = -1;
+
+  /* Look the block up from the core outwards */
+  for (uint32_t i = 0; i < hierarchy->levels; i++) {
+    cache_sim_t *sim = &hierarchy->level[i];
+    cache_t *cache = sim->caches[type];
+    int way;
+
+    level_ids(sim, address, &index, &tag);
+    sim->stats.accesses++;
+    way = lookup_way(cache, index, tag);
+    if (way >= 0) {
+      policy_touch(cache, cache->policy, index, way);
+      sim->stats.hits++;
+      hit = i;
+      break;
+    }
+  }
+  if (hit < 0) {
+    hierarchy->memory_accesses++;
+  }
+
+  if (hierarchy->inclusion == exclusive) {
+    if (hit == 0) {
+      return;
+    }
+    /* The block moves up to the first level ... */
+    if (hit > 0) {
+      cache_sim_t *sim = &hierarchy->level[hit];
+      level_ids(sim, address, &index, &tag);
+      cache_invalidate(sim->caches[type], index, tag);
+    }
+    /* ... and every victim moves one level down */
+    for (uint32_t i = 0; i < hierarchy->levels; i++) {
+      cache_sim_t *sim = &hierarchy->level[i];
+      cache_t *cache = sim->caches[type];
+
+      level_ids(sim, address, &index, &tag);
+      if (i > 0) {
+        /* Also held here when the first level is split */
+        int way = lookup_way(cache, index, tag);
+        if (way >= 0) {
+          policy_touch(cache, cache->policy, index, way);
+          break;
+        }
+      }
+      if (!cache_fill(cache, index, tag)) {
+        break;
+      }
+      address = level_address(sim, index, cache->victim);
+    }
+    return;
+  }
+
+  /* Fill every level that missed, lowest first so that back-invalidation
+   * never drops the block just filled
+   */
+  for (int i = ((hit < 0) ? (int)hierarchy->levels : hit) - 1; i >= 0; i--) {
+    cache_sim_t *sim = &hierarchy->level[i];
+    cache_t *cache = sim->caches[type];
+
+    level_ids(sim, address, &index, &tag);
+    if (cache_fill(cache, index, tag) && hierarchy->inclusion == inclusive && i > 0) {
+      back_invalidate(hierarchy, i, level_address(sim, index, cache->victim));
+    }
+  }
+}
+
+/* Average memory access time in cycles, every level looked up adds its latency */
+double hierarchy_amat(const hierarchy_t *hierarchy)
+{
+  double cycles = (double)hierarchy->memory_accesses * hierarchy->memory_latency;
+
+  if (hierarchy->levels == 0 || hierarchy->level[0].stats.accesses == 0) {
+    return 0.0;
+  }
+  for (uint32_t i = 0; i < hierarchy->levels; i++) {
+    cycles += (double)hierarchy->level[i].stats.accesses * hierarchy->latency[i];
+  }
+  return cycles / hierarchy->level[0].stats.accesses;
+}
+
+/**
+ * Simulates a cache hierarchy in a single pass over the trace and prints
+ * the statistics of every level and the average memory access time
+*/
+int run_hierarchy(const char *config_path, const char *trace_path)
+{
+  hierarchy_t hierarchy;
+  trace_t trace;
+  static access_batch_t batch;
+
+  if (hierarchy_init(&hierarchy, config_path)) {
+    return -1;
+  }
+  if (trace_open(&trace, trace_path)) {
+    printf("Unable to open the trace file\n");
+    hierarchy_deinit(&hierarchy);
+    return -1;
+  }
+
+  while (trace_read_batch(&trace, &batch) > 0) {
+    for (size_t i = 0; i < batch.len; i++) {
+      hierarchy_access(&hierarchy, batch.address[i], batch.type[i]);
+    }
+  }
+  trace_close(&trace);
+
+  printf("Inclusion: %s\n", inclusion_name[hierarchy.inclusion]);
+  printf("%-5s %-10s %-7s %-4s %6s %-7s %7s %12s %12s %12s %8s\n",
+         "Level", "Size", "Mapping", "Org", "Ways", "Policy", "Latency",
+         "Accesses", "Hits", "Evicts", "Hit Rate");
+  for (uint32_t i = 0; i < hierarchy.levels; i++) {
+    cache_sim_t *sim = &hierarchy.level[i];
+
+    sim->stats.evicts = sim->cache[0].evicts + sim->cache[1].evicts;
+    printf("L%-4u %-10u %-7s %-4s %6u %-7s %7u %12" PRIu64 " %12" PRIu64
+           " %12" PRIu64 " %8.4f\n",
+           i + 1, sim->config.size, mapping_name[sim->config.mapping],
+           org_name[sim->config.org], sim->ways, policy_name[sim->config.policy],
+           hierarchy.latency[i], sim->stats.accesses, sim->stats.hits,
+           sim->stats.evicts,
+           sim->stats.accesses ? (double)sim->stats.hits / sim->stats.accesses : 0.0);
+  }
+  printf("Memory accesses: %" PRIu64 " (latency %u)\n",
+         hierarchy.memory_accesses, hierarchy.memory_latency);
+  printf("AMAT: %.2f cycles\n", hierarchy_amat(&hierarchy));
+
+  hierarchy_deinit(&hierarchy);
+  return 0;
+}
+
+static const char *protocol_name[] = { "msi", "mesi", "moesi" };
+
+/**
+ * Reads a coherence configuration: a "size mapping org [ways] [policy]"
+ * line for the private caches of every core, optionally "protocol
+ * msi|mesi|moesi" and "cores <n>". cores is the number of per-core
+ * traces, 0 if the configuration gives it.
+*/
+int coherence_init(coherence_t *coh, const char *config_path, uint32_t cores)
+{
+  cache_config_t config;
+  uint32_t configured = 0;
+  bool has_config = false;
+  size_t blocks;
+  char line[256];
+  FILE *file;
+
+  memset(coh, 0, sizeof(coherence_t));
+  coh->protocol = mesi;
+
+  file = fopen(config_path, "r");
+  if (!file) {
+    printf("Unable to open the coherence configuration file\n");
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    char key[16], value[16];
+    int ret;
+
+    if (sscanf(line, "%15s %15s", key, value) == 2) {
+      if (strcmp(key, "cores") == 0) {
+        configured = atoi(value);
+        continue;
+      }
+      if (strcmp(key, "protocol") == 0) {
+        size_t i;
+        for (i = 0; i < 3 && strcmp(value, protocol_name[i]) != 0; i++);
+        if (i == 3) {
+          printf("Unknown coherence protocol\n");
+          fclose(file);
+          return -1;
+        }
+        coh->protocol = (protocol_t)i;
+        continue;
+      }
+    }
+
+    ret = parse_config_line(line, &config, NULL);
+    if (ret < 0 || (ret == 0 && has_config)) {
+      if (ret == 0) {
+        printf("All cores have the same private caches, configure them once\n");
+      }
+      fclose(file);
+      return -1;
+    }
+    has_config |= (ret == 0);
+  }
+  fclose(file);
+
+  if (!has_config) {
+    printf("The private caches of the cores are not configured\n");
+    return -1;
+  }
+  if (cores && configured && cores != configured) {
+    printf("%u cores are configured, but there are %u traces\n", configured, cores);
+    return -1;
+  }
+  coh->cores = cores ? cores : configured;
+  coh->caches = (config.org == sc) ? 2 : 1;
+  if (coh->cores == 0 || coh->cores * coh->caches > MAX_COHERENT_CACHES) {
+    printf("Number of cores must be 1-%u\n", MAX_COHERENT_CACHES / coh->caches);
+    return -1;
+  }
+  if (config.write != wp_wb) {
+    printf("Coherent caches are write-back write-allocate\n");
+    return -1;
+  }
+  if (config.prefetch != pf_none || config.victim || config.classify) {
+    printf("Prefetchers, victim caches and miss classification are not modeled "
+           "with coherence\n");
+    return -1;
+  }
+
+  coh->core = calloc(coh->cores, sizeof(coherence_core_t));
+  if (!coh->core) {
+    printf("Failed to allocate memory for the cores\n");
+    return -1;
+  }
+  for (uint32_t i = 0; i < coh->cores; i++) {
+    coherence_core_t *core = &coh->core[i];
+
+    if (cache_sim_init(&core->sim, &config)) {
+      coh->cores = i;
+      coherence_deinit(coh);
+      return -1;
+    }
+    for (uint32_t c = 0; c < coh->caches; c++) {
+      core->state[c] = calloc(core->sim.length, sizeof(uint8_t));
+      if (!core->state[c]) {
+        printf("Failed to allocate memory for the coherence states\n");
+        coh->cores = i + 1;
+        coherence_deinit(coh);
+        return -1;
+      }
+    }
+  }
+
+  /* Every cached block has an entry, keep the directory at most half full */
+  blocks = (size_t)coh->core[0].sim.length * coh->cores * coh->caches;
+  for (coh->dir_size = 64; coh->dir_size < 2 * blocks; coh->dir_size <<= 1);
+  coh->dir = calloc(coh->dir_size, sizeof(dir_entry_t));
+  if (!coh->dir) {
+    printf("Failed to allocate memory for the directory\n");
+    coherence_deinit(coh);
+    return -1;
+  }
+  return 0;
+}
+
+void coherence_deinit(coherence_t *coh)
+{
+  for (uint32_t i = 0; i < coh->cores; i++) {
+    cache_sim_deinit(&coh->core[i].sim);
+    free(coh->core[i].state[0]);
+    free(coh->core[i].state[1]);
+  }
+  free(coh->core);
+  free(coh->dir);
+  coh->core = NULL;
+  coh->dir = NULL;
+  coh->cores = 0;
+}
+
+static inline size_t dir_home(const coherence_t *coh, uint64_t key)
+{
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (coh->dir_size - 1);
+}
+
+/* Directory slot of block, empty if no cache holds it */
+static inline size_t dir_slot(const coherence_t *coh, uint64_t block)
+{
+  size_t mask = coh->dir_size - 1;
+  size_t i = dir_home(coh, block + 1);
+
+  while (coh->dir[i].key != 0 && coh->dir[i].key != block + 1) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* Empties slot i, moving back the entries probed past it */
+static void dir_remove(coherence_t *coh, size_t i)
+{
+  size_t mask = coh->dir_size - 1;
+
+  for (size_t j = (i + 1) & mask; coh->dir[j].key != 0; j = (j + 1) & mask) {
+    size_t home = dir_home(coh, coh->dir[j].key);
+
+    /* Entry j stays unless its home is cyclically in (i, j] */
+    if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+      coh->dir[i] = coh->dir[j];
+      i = j;
+    }
+  }
+  coh->dir[i].key = 0;
+  coh->dir[i].holders = 0;
+}
+
+/* State of the block of cache bit holder, its way is returned in slot */
+static inline uint8_t *holder_state(coherence_t *coh, uint32_t holder,
+                                    uint32_t index, uint64_t tag)
+{
+  coherence_core_t *core = &coh->core[holder / coh->caches];
+  cache_t *cache = &core->sim.cache[holder % coh->caches];
+  int way = lookup_way(cache, index, tag);
+
+  assert(way >= 0);
+  return &core->state[holder % coh->caches][(size_t)index * cache->ways + way];
+}
+
+/* Invalidates the block in every cache of holders */
+static void invalidate_holders(coherence_t *coh, uint64_t holders,
+                               uint32_t index, uint64_t tag)
+{
+  while (holders) {
+    uint32_t holder = __builtin_ctzll(holders);
+    coherence_core_t *core = &coh->core[holder / coh->caches];
+    cache_t *cache = &core->sim.cache[holder % coh->caches];
+    int way = lookup_way(cache, index, tag);
+    size_t block = (size_t)index * cache->ways + way;
+
+    holders &= holders - 1;
+    assert(way >= 0);
+    if (cache->hash) {
+      tag_index_remove(cache, index, way);
+    }
+    CLEAR_BLOCK_VALID(cache, block);
+    cache->set[index].holes++;
+    core->state[holder % coh->caches][block] = st_invalidated;
+    core->invalidations++;
+  }
+}
+
+/* Whether the block missed was invalidated by another cache and is still
+ * in its set, it would have hit without the invalidation
+ */
+static bool coherence_miss(const cache_t *cache, const uint8_t *state,
+                           uint32_t index, uint64_t tag)
+{
+  size_t base = (size_t)index * cache->ways;
+
+  for (uint32_t way = 0; way < cache->ways; way++) {
+    if (state[base + way] == st_invalidated && !BLOCK_VALID(cache, base + way) &&
+        tag_matches(cache, base + way, tag)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Simulates one access of a core and the coherence actions it causes */
+void coherence_access(coherence_t *coh, uint32_t core_id, uint64_t address,
+                      access_t type, bool write)
+{
+  coherence_core_t *core = &coh->core[core_id];
+  cache_sim_t *sim = &core->sim;
+  uint32_t c = (sim->config.org == sc) ? type : 0;
+  cache_t *cache = &sim->cache[c];
+  uint8_t *state = core->state[c];
+  uint64_t self = 1ULL << (core_id * coh->caches + c);
+  uint64_t block = address >> sim->bits.offset;
+  uint64_t others;
+  uint8_t fill_state;
+  uint32_t index;
+  uint64_t tag;
+  size_t slot;
+  int way;
+
+  level_ids(sim, address, &index, &tag);
+  sim->stats.accesses++;
+  sim->stats.writes += write;
+
+  way = lookup_way(cache, index, tag);
+  if (way >= 0) {
+    uint8_t *st = &state[(size_t)index * cache->ways + way];
+
+    policy_touch(cache, cache->policy, index, way);
+    sim->stats.hits++;
+    if (!write || *st == st_modified) {
+      return;
+    }
+    if (*st == st_exclusive) {
+      /* Silent upgrade, no other cache holds it */
+      *st = st_modified;
+      return;
+    }
+    /* Shared or owned, the other copies are invalidated */
+    coh->bus_upgrades++;
+    slot = dir_slot(coh, block);
+    invalidate_holders(coh, coh->dir[slot].holders & ~self, index, tag);
+    coh->dir[slot].holders = self;
+    *st = st_modified;
+    return;
+  }
+
+  if (cache->set[index].holes && coherence_miss(cache, state, index, tag)) {
+    core->coherence_misses++;
+  }
+
+  /* Fill first, the victim may move directory entries */
+  if (cache_fill(cache, index, tag)) {
+    uint64_t victim = ((cache->victim << sim->bits.index) | index);
+    uint8_t victim_state;
+    size_t victim_slot;
+
+    way = lookup_way(cache, index, tag);
+    victim_state = state[(size_t)index * cache->ways + way];
+    coh->writebacks += (victim_state == st_modified || victim_state == st_owned);
+    victim_slot = dir_slot(coh, victim);
+    coh->dir[victim_slot].holders &= ~self;
+    if (coh->dir[victim_slot].holders == 0) {
+      dir_remove(coh, victim_slot);
+    }
+  } else {
+    way = lookup_way(cache, index, tag);
+  }
+
+  slot = dir_slot(coh, block);
+  others = coh->dir[slot].holders & ~self;
+  if (write) {
+    /* A dirty copy is passed on, ownership moves without a writeback */
+    coh->bus_read_exclusives++;
+    for (uint64_t h = others; h; h &= h - 1) {
+      uint8_t st = *holder_state(coh, __builtin_ctzll(h), index, tag);
+      coh->transfers += (st == st_modified || st == st_owned);
+    }
+    invalidate_holders(coh, others, index, tag);
+    coh->dir[slot].holders = self;
+    fill_state = st_modified;
+  } else {
+    coh->bus_reads++;
+    fill_state = (others || coh->protocol == msi) ? st_shared : st_exclusive;
+    for (uint64_t h = others; h; h &= h - 1) {
+      uint8_t *st = holder_state(coh, __builtin_ctzll(h), index, tag);
+
+      if (*st == st_modified) {
+        /* MOESI keeps the block dirty in the owner, the others write it back */
+        coh->transfers++;
+        if (coh->protocol == moesi) {
+          *st = st_owned;
+        } else {
+          coh->writebacks++;
+          *st = st_shared;
+        }
+      } else if (*st == st_owned) {
+        coh->transfers++;
+      } else if (*st == st_exclusive) {
+        *st = st_shared;
+      }
+    }
+    coh->dir[slot].holders |= self;
+  }
+  coh->dir[slot].key = block + 1;
+  state[(size_t)index * cache->ways + way] = fill_state;
+}
+
+/**
+ * Simulates the private caches of several cores kept coherent in a single
+ * pass. Either every trace feeds one core, interleaved an access at a
+ * time, or a single trace holds the core of every record.
+*/
+int run_coherence(const char *config_path, const char *const *trace_paths, uint32_t count)
+{
+  coherence_t coh;
+  trace_t *traces;
+  access_batch_t *batches;
+  size_t *pos;
+  uint32_t active = count;
+  int ret = 0;
+
+  if (coherence_init(&coh, config_path, (count > 1) ? count : 0)) {
+    return -1;
+  }
+  traces = calloc(count, sizeof(trace_t));
+  batches = malloc(count * sizeof(access_batch_t));
+  pos = calloc(count, sizeof(size_t));
+  if (!traces || !batches || !pos) {
+    printf("Failed to allocate memory for the traces\n");
+    free(traces);
+    free(batches);
+    free(pos);
+    coherence_deinit(&coh);
+    return -1;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (trace_open(&traces[i], trace_paths[i])) {
+      printf("Unable to open the trace file\n");
+      while (i--) {
+        trace_close(&traces[i]);
+      }
+      free(traces);
+      free(batches);
+      free(pos);
+      coherence_deinit(&coh);
+      return -1;
+    }
+    batches[i].len = 0;
+  }
+
+  if (count == 1) {
+    while (ret == 0 && trace_read_batch(&traces[0], &batches[0]) > 0) {
+      for (size_t i = 0; i < batches[0].len; i++) {
+        if (batches[0].core[i] >= coh.cores) {
+          printf("Core %u of the trace is not configured\n", batches[0].core[i]);
+          ret = -1;
+          break;
+        }
+        coherence_access(&coh, batches[0].core[i], batches[0].address[i],
+                         batches[0].type[i], batches[0].write[i]);
+      }
+    }
+  } else {
+    /* pos is SIZE_MAX once the trace of the core ended */
+    while (active) {
+      for (uint32_t c = 0; c < count; c++) {
+        if (pos[c] == SIZE_MAX) {
+          continue;
+        }
+        if (pos[c] == batches[c].len) {
+          pos[c] = 0;
+          if (trace_read_batch(&traces[c], &batches[c]) == 0) {
+            pos[c] = SIZE_MAX;
+            active--;
+            continue;
+          }
+        }
+        coherence_access(&coh, c, batches[c].address[pos[c]], batches[c].type[pos[c]],
+                         batches[c].write[pos[c]]);
+        pos[c]++;
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    trace_close(&traces[i]);
+  }
+  free(traces);
+  free(batches);
+  free(pos);
+  if (ret) {
+    coherence_deinit(&coh);
+    return ret;
+  }
+
+  printf("Protocol: %s, %u cores\n", protocol_name[coh.protocol], coh.cores);
+  printf("%-5s %12s %12s %12s %8s %12s %13s\n", "Core", "Accesses", "Hits", "Evicts",
+         "Hit Rate", "Coherence", "Invalidations");
+  for (uint32_t i = 0; i < coh.cores; i++) {
+    cache_sim_t *sim = &coh.core[i].sim;
+
+    sim->stats.evicts = sim->cache[0].evicts + sim->cache[1].evicts;
+    printf("%-5u %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %8.4f %12" PRIu64
+           " %13" PRIu64 "\n",
+           i, sim->stats.accesses, sim->stats.hits, sim->stats.evicts,
+           sim->stats.accesses ? (double)sim->stats.hits / sim->stats.accesses : 0.0,
+           coh.core[i].coherence_misses, coh.core[i].invalidations);
+  }
+  printf("Bus reads:            %" PRIu64 "\n", coh.bus_reads);
+  printf("Bus read exclusives:  %" PRIu64 "\n", coh.bus_read_exclusives);
+  printf("Bus upgrades:         %" PRIu64 "\n", coh.bus_upgrades);
+  printf("Writebacks:           %" PRIu64 "\n", coh.writebacks);
+  printf("Bus transactions:     %" PRIu64 "\n",
+         coh.bus_reads + coh.bus_read_exclusives + coh.bus_upgrades + coh.writebacks);
+  printf("Cache transfers:      %" PRIu64 "\n", coh.transfers);
+
+  coherence_deinit(&coh);
+  return 0;
+}
+
+/* capacity is a power of two, the time slots and the line map start with it */
+static int stack_dist_alloc(stack_dist_t *sd, uint32_t capacity)
+{
+  memset(sd, 0, sizeof(stack_dist_t));
+  sd->capacity = capacity;
+  sd->map_size = capacity;
+  sd->tree = calloc((size_t)sd->capacity + 1, sizeof(uint32_t));
+  sd->keys = calloc(sd->map_size, sizeof(uint64_t));
+  sd->times = malloc(sd->map_size * sizeof(uint32_t));
+
+  if (!sd->tree || !sd->keys || !sd->times) {
+    printf("Failed to allocate memory for the stack distance analysis\n");
+    stack_dist_deinit(sd);
+    return -1;
+  }
+  return 0;
+}
+
+int stack_dist_init(stack_dist_t *sd)
+{
+  return stack_dist_alloc(sd, STACK_DIST_MIN_CAPACITY);
+}
+
+void stack_dist_deinit(stack_dist_t *sd)
+{
+  free(sd->tree);
+  free(sd->keys);
+  free(sd->times);
+  memset(sd, 0, sizeof(stack_dist_t));
+}
+
+/* Fenwick tree over time slots 0..capacity-1 (stored 1-based) */
+static inline void fenwick_add(uint32_t *tree, uint32_t capacity, uint32_t pos, int32_t value)
+{
+  for (pos++; pos <= capacity; pos += pos & -pos) {
+    tree[pos] += value;
+  }
+}
+
+static inline uint32_t fenwick_prefix(const uint32_t *tree, uint32_t pos)
+{
+  uint32_t sum = 0;
+
+  for (pos++; pos > 0; pos -= pos & -pos) {
+    sum += tree[pos];
+  }
+  return sum;
+}
+
+static inline size_t line_home(const stack_dist_t *sd, uint64_t key)
+{
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (sd->map_size - 1);
+}
+
+static inline size_t line_slot(const stack_dist_t *sd, uint64_t key)
+{
+  size_t mask = sd->map_size - 1;
+  size_t i = line_home(sd, key);
+
+  while (sd->keys[i] != 0 && sd->keys[i] != key) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Renumbers the live times to 0..active-1 in order, growing the tree and
+ * the line map when they are more than half full
+ */
+static void stack_dist_compact(stack_dist_t *sd)
+{
+  /* time << 32 | map slot, sorted by time */
+  uint64_t *order = malloc((size_t)sd->active * sizeof(uint64_t));
+  uint32_t n = 0;
+
+  if (!order) {
+    printf("Failed to allocate memory for the stack distance analysis\n");
+    exit(1);
+  }
+
+  if ((size_t)sd->active * 2 > sd->map_size) {
+    /* Rehash into a map twice the size */
+    size_t old_size = sd->map_size;
+    uint64_t *old_keys = sd->keys;
+    uint32_t *old_times = sd->times;
+
+    sd->map_size *= 2;
+    sd->keys = calloc(sd->map_size, sizeof(uint64_t));
+    sd->times = malloc(sd->map_size * sizeof(uint32_t));
+    if (!sd->keys || !sd->times) {
+      printf("Failed to allocate memory for the stack distance analysis\n");
+      exit(1);
+    }
+    for (size_t i = 0; i < old_size; i++) {
+      if (old_keys[i]) {
+        size_t slot = line_slot(sd, old_keys[i]);
+        sd->keys[slot] = old_keys[i];
+        sd->times[slot] = old_times[i];
+      }
+    }
+    free(old_keys);
+    free(old_times);
+  }
 
-void set_cache_bits(cache_bits_t *cache_bits,
-                  uint32_t cache_length,
-                  cache_map_t cache_mapping,
-                  cache_org_t cache_org);
+  for (size_t i = 0; i < sd->map_size; i++) {
+    if (sd->keys[i]) {
+      order[n++] = ((uint64_t)sd->times[i] << 32) | i;
+    }
+  }
+  qsort(order, n, sizeof(uint64_t), compare_u64);
 
-int cache_init(cache_t *cache, uint8_t length);
+  if ((size_t)sd->active * 2 > sd->capacity) {
+    sd->capacity *= 2;
+    free(sd->tree);
+    sd->tree = malloc(((size_t)sd->capacity + 1) * sizeof(uint32_t));
+    if (!sd->tree) {
+      printf("Failed to allocate memory for the stack distance analysis\n");
+      exit(1);
+    }
+  }
 
-void cache_deinit(cache_t *cache);
+  for (uint32_t t = 0; t < n; t++) {
+    sd->times[(uint32_t)order[t]] = t;
+  }
 
-void set_access_identifiers(mem_access_t *access, cache_bits_t cache_bits);
+  /* Slots 0..n-1 are marked, build the tree in linear time */
+  memset(sd->tree, 0, ((size_t)sd->capacity + 1) * sizeof(uint32_t));
+  for (uint32_t i = 1; i <= sd->capacity; i++) {
+    uint32_t parent = i + (i & -i);
 
-int access_cache_dm(cache_t *cache, const mem_access_t *access);
+    sd->tree[i] += (i <= n);
+    if (parent <= sd->capacity) {
+      sd->tree[parent] += sd->tree[i];
+    }
+  }
+  sd->now = n;
 
-int access_cache_fa(cache_t *cache, const mem_access_t *access);
+  free(order);
+}
 
-int is_address_in_fa_cache(const cache_t *cache, const mem_access_t *access);
+/* Records an access to a line, O(log n) in the number of time slots.
+ * Returns its stack distance, STACK_DIST_COLD for a first access.
+ */
+uint32_t stack_dist_access(stack_dist_t *sd, uint64_t line)
+{
+  uint64_t key = line + 1;
+  uint32_t distance = STACK_DIST_COLD;
+  size_t slot;
 
-void transfer_address_to_cache(cache_t *cache, const mem_access_t *access);
+  if (sd->now == sd->capacity) {
+    stack_dist_compact(sd);
+  }
 
-// #endif
+  sd->accesses++;
+  slot = line_slot(sd, key);
+  if (sd->keys[slot] == 0) {
+    /* First access, infinite distance */
+    sd->cold++;
+    sd->active++;
+    sd->keys[slot] = key;
+  } else {
+    /* Distinct lines touched since the last access to this one */
+    uint32_t last = sd->times[slot];
 
-uint32_t block_size = 64;
-cache_stat_t cache_statistics;
+    distance = sd->active - fenwick_prefix(sd->tree, last);
+    sd->hist[distance ? 32 - __builtin_clz(distance) : 0]++;
+    fenwick_add(sd->tree, sd->capacity, last, -1);
+  }
 
-static void print_cache_hit(const mem_access_t *access);
-static void print_cache_miss(const mem_access_t *access);
+  sd->times[slot] = sd->now;
+  fenwick_add(sd->tree, sd->capacity, sd->now, 1);
+  sd->now++;
 
-static void print_cache_hit(const mem_access_t *access)
-{
-  printf("0x%x - Cache hit\n", access->address);
+  /* Keep the line map at most half full */
+  if ((size_t)sd->active * 2 > sd->map_size) {
+    stack_dist_compact(sd);
+  }
+  return distance;
 }
 
-static void print_cache_miss(const mem_access_t *access)
+/* Forgets a line as if it was never accessed, the distances of the other
+ * lines no longer count it
+ */
+static void stack_dist_remove(stack_dist_t *sd, uint64_t line)
 {
-  printf("0x%x - Cache miss\n", access->address);
-}
+  size_t mask = sd->map_size - 1;
+  size_t i = line_slot(sd, line + 1);
 
-/* Reads a memory access from the trace file and returns
- * 1) access type (instruction or data access
- * 2) memory address
- */
-mem_access_t read_transaction(FILE* ptr_file) {
-  char type;
-  mem_access_t access;
+  if (sd->keys[i] == 0) {
+    return;
+  }
+  fenwick_add(sd->tree, sd->capacity, sd->times[i], -1);
+  sd->active--;
 
-  if (fscanf(ptr_file, "%c %x\n", &type, &access.address) == 2) {
-    if (type != 'I' && type != 'D') {
-      printf("Unkown access type\n");
-      exit(0);
+  /* Move back the lines probed past the slot */
+  for (size_t j = (i + 1) & mask; sd->keys[j] != 0; j = (j + 1) & mask) {
+    size_t home = line_home(sd, sd->keys[j]);
+
+    if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+      sd->keys[i] = sd->keys[j];
+      sd->times[i] = sd->times[j];
+      i = j;
     }
-    access.accesstype = (type == 'I') ? instruction : data;
-    return access;
   }
-
-  /* If there are no more entries in the file,
-   * return an address 0 that will terminate the infinite loop in main
-   */
-  access.address = 0;
-  return access;
+  sd->keys[i] = 0;
 }
 
-bool is_power_of_two(uint32_t n) {
-    return n && !(n & (n - 1));
+/* Hits of a fully associative LRU cache of blocks lines, blocks being
+ * a power of two
+ */
+uint64_t stack_dist_hits(const stack_dist_t *sd, uint32_t blocks)
+{
+  uint64_t hits = 0;
+  int k = countBits(blocks);
+
+  /* Hit if fewer than blocks distinct lines were touched in between */
+  for (int b = 0; b <= k && b < 34; b++) {
+    hits += sd->hist[b];
+  }
+  return hits;
 }
 
-int verify_cache_size(uint32_t cache_size)
+/**
+ * Computes LRU hit rates of all power of two fully associative cache
+ * sizes in a single pass over the trace. A split cache gives each
+ * access type its own stack and half of the size.
+*/
+int run_stack_distance(const char *trace_path, cache_org_t cache_org, uint32_t block_size)
 {
-  if (cache_size < 128) {
-    printf("Cache size is too small, minimum of 128 bytes\n");
-    return -1;
-  } else if (cache_size > 4096) {
-    printf("Cache size is too large, maximum of 4096 bytes\n");
-    return -1;
-  } else if (!is_power_of_two(cache_size)) {
-    printf("Invalid cache size. It must be a power of 2\n");
+  stack_dist_t sd[2];
+  trace_t trace;
+  static access_batch_t batch;
+  const uint32_t offset = countBits(block_size);
+  int stacks = (cache_org == uc) ? 1 : 2;
+
+  for (int i = 0; i < stacks; i++) {
+    if (stack_dist_init(&sd[i])) {
+      if (i) {
+        stack_dist_deinit(&sd[0]);
+      }
+      return -1;
+    }
+  }
+
+  if (trace_open(&trace, trace_path)) {
+    printf("Unable to open the trace file\n");
+    for (int i = 0; i < stacks; i++) {
+      stack_dist_deinit(&sd[i]);
+    }
     return -1;
   }
 
-  return 0;
-}
+  while (trace_read_batch(&trace, &batch) > 0) {
+    for (size_t i = 0; i < batch.len; i++) {
+      stack_dist_access(&sd[(cache_org == uc) ? 0 : batch.type[i]],
+                        batch.address[i] >> offset);
+    }
+  }
+  trace_close(&trace);
 
-int countBits(uint8_t n) {
-  int count = 0;
+  uint64_t accesses = sd[0].accesses + ((stacks == 2) ? sd[1].accesses : 0);
+  uint64_t cold = sd[0].cold + ((stacks == 2) ? sd[1].cold : 0);
 
-  while (n > 1) {
-      count++;
-      n >>= 1;
+  printf("LRU stack distance, fully associative %s cache\n",
+         (cache_org == uc) ? "unified" : "split");
+  printf("Accesses: %" PRIu64 ", compulsory misses: %" PRIu64 "\n\n", accesses, cold);
+  printf("%-10s %10s %12s %8s\n", "Size", "Blocks", "Hits", "Hit Rate");
+  for (uint32_t size = MIN_CACHE_SIZE; size && size <= MAX_CACHE_SIZE; size <<= 1) {
+    uint32_t blocks = get_cache_length(size, cache_org, block_size);
+    uint64_t hits = 0;
+
+    for (int i = 0; i < stacks; i++) {
+      hits += stack_dist_hits(&sd[i], blocks);
+    }
+    if (blocks == 0) {
+      continue;
+    }
+    printf("%-10u %10u %12" PRIu64 " %8.4f\n", size, blocks, hits,
+           (double)hits / accesses);
   }
 
-  return count;
+  for (int i = 0; i < stacks; i++) {
+    stack_dist_deinit(&sd[i]);
+  }
+  return 0;
 }
 
-uint32_t get_cache_length(uint32_t cache_size, cache_org_t cache_org)
+/* Hash of a line for spatial sampling, uniform in [0, SHARDS_MODULUS) */
+static inline uint32_t shards_hash(uint64_t line)
 {
-  if (cache_org == uc) {
-    /* Unifed cache */
-    return(cache_size / block_size);
-  } else {
-    /* split cache */
-    return(cache_size / block_size / 2);
-  }
+  line ^= line >> 33;
+  line *= 0xff51afd7ed558ccdULL;
+  line ^= line >> 33;
+  line *= 0xc4ceb9fe1a85ec53ULL;
+  line ^= line >> 33;
+  return (uint32_t)line & (SHARDS_MODULUS - 1);
 }
 
-void set_cache_bits(cache_bits_t *cache_bits,
-                  uint32_t cache_length,
-                  cache_map_t cache_mapping,
-                  cache_org_t cache_org)
+int shards_init(shards_t *sh, uint32_t max_lines)
 {
-  cache_bits->offset = countBits(block_size);
+  uint32_t capacity = 1024;
 
-  if (cache_mapping == dm) {
-    /* direct mapped */
-    cache_bits->index = countBits(cache_length);
-  } else {
-    /* fully associative */
-    cache_bits->index = 0;
+  memset(sh, 0, sizeof(shards_t));
+  if (max_lines == 0 || max_lines > (1U << 28)) {
+    printf("Number of sampled lines must be 1-%u\n", 1U << 28);
+    return -1;
+  }
+  /* Never more than max_lines + 1 live lines, the stack never grows */
+  while (capacity < 4 * max_lines) {
+    capacity <<= 1;
+  }
+  if (stack_dist_alloc(&sh->sd, capacity)) {
+    return -1;
   }
+  sh->heap = malloc(((size_t)max_lines + 1) * sizeof(shards_entry_t));
+  if (!sh->heap) {
+    printf("Failed to allocate memory for the miss ratio curve\n");
+    stack_dist_deinit(&sh->sd);
+    return -1;
+  }
+  sh->threshold = SHARDS_MODULUS;
+  sh->max_lines = max_lines;
+  return 0;
+}
 
-  cache_bits->tag = 32 - cache_bits->offset - cache_bits->index;
+void shards_deinit(shards_t *sh)
+{
+  stack_dist_deinit(&sh->sd);
+  free(sh->heap);
+  sh->heap = NULL;
 }
 
-int cache_init(cache_t *cache, uint8_t length)
+static void shards_heap_push(shards_t *sh, uint64_t line, uint32_t hash)
 {
-  /* Each cache block includes:
-   *  1 valid bit
-   *  32 tag bits
-   *  64 bytes of data
-   */
-  cache->block = (cache_block_t *)calloc((size_t)length, sizeof(cache_block_t));
+  uint32_t i = sh->heap_len++;
 
-  if (cache->block == NULL) {
-    printf("cache memory allocation failed\n");
-    return -1;
+  while (i > 0 && sh->heap[(i - 1) / 2].hash < hash) {
+    sh->heap[i] = sh->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
   }
-
-  /* The following will be used for searching through a fully associative cache */
-  cache->length = length;
-  cache->start = 0;
-  cache->end = 0;
-  cache->is_full = false;
-
-  return 0;
+  sh->heap[i].line = line;
+  sh->heap[i].hash = hash;
 }
 
-void cache_deinit(cache_t *cache)
+static void shards_heap_pop(shards_t *sh)
 {
-  cache->block->tag = 0;
-  cache->block->valid = 0;
-  free(cache->block);
+  shards_entry_t last = sh->heap[--sh->heap_len];
+  uint32_t i = 0;
 
-  cache->length = 0;
-  cache->is_full = 0;
-  cache->end = 0;
-  cache->start = 0;
+  while (2 * i + 1 < sh->heap_len) {
+    uint32_t child = 2 * i + 1;
+
+    if (child + 1 < sh->heap_len && sh->heap[child + 1].hash > sh->heap[child].hash) {
+      child++;
+    }
+    if (sh->heap[child].hash <= last.hash) {
+      break;
+    }
+    sh->heap[i] = sh->heap[child];
+    i = child;
+  }
+  sh->heap[i] = last;
 }
 
-void set_access_identifiers(mem_access_t *access, cache_bits_t cache_bits)
+/* Records an access to a line, only sampled lines reach the stack */
+void shards_access(shards_t *sh, uint64_t line)
 {
-  /* byte offset: mask off lower n bits, n being cache_bits.offset */
-  access->offset = access->address & MASK(cache_bits.offset);
+  uint32_t hash = shards_hash(line);
+  uint32_t distance;
+  double scale;
 
-  /* index: shift address to right by cache_bits.offset number of bits, mask off index*/
-  access->index = (access->address >> cache_bits.offset) & MASK(cache_bits.index);
+  sh->accesses++;
+  if (hash >= sh->threshold) {
+    return;
+  }
 
-  /* tag: same as was done for index, except now for the tag bits */
-  access->tag = (access->address >>
-    (cache_bits.index + cache_bits.offset)) & MASK(cache_bits.tag);
+  scale = (double)SHARDS_MODULUS / sh->threshold;
+  sh->weight += scale;
+  distance = stack_dist_access(&sh->sd, line);
+  if (distance != STACK_DIST_COLD) {
+    uint64_t scaled = (uint64_t)(distance * scale);
+    int bucket = scaled ? 64 - __builtin_clzll(scaled) : 0;
 
-  // printf("set_access_identifiers 0x%x - idx: %x, tag: %x, offset: %x\n",
-  //   access->address ,access->index, access->tag, access->offset);
-}
+    sh->hist[(bucket < 63) ? bucket : 63] += scale;
+    return;
+  }
 
-int access_cache_dm(cache_t *cache, const mem_access_t * access)
-{
-  /* First check valid bit of index */
-  if (cache->block[access->index].valid) {
-    /* Valid bit set, so next compare tags */
-    if (cache->block[access->index].tag == access->tag) {
-      /* Valid bit set and tags match, cache hit! */
-      // print_cache_hit(access);
-      return 1;
-    } else {
-      /* Tags do not match, cache miss. Overwrite new address to this block, update tag */
-      cache->block[access->index].tag = access->tag;
-      // print_cache_miss(access);
-      cache_statistics.evicts++;
-      return 0;
+  shards_heap_push(sh, line, hash);
+  if (sh->sd.active > sh->max_lines) {
+    /* Stop sampling the largest hash, and drop its lines */
+    sh->threshold = sh->heap[0].hash;
+    while (sh->heap_len && sh->heap[0].hash >= sh->threshold) {
+      stack_dist_remove(&sh->sd, sh->heap[0].line);
+      shards_heap_pop(sh);
     }
-  } else {
-    /* Valid bit is not set, cache miss. Write address to cache */
-    cache->block[access->index].valid = true;
-    cache->block[access->index].tag = access->tag;
-    // print_cache_miss(access);
-    return 0;
   }
-
-  return -1;
 }
 
-int is_address_in_fa_cache(const cache_t *cache, const mem_access_t *access)
+/**
+ * Miss ratio of a fully associative LRU cache of blocks lines, a power of
+ * two: the weighted fraction of sampled accesses that miss. SHARDS_adj
+ * instead counts the shortfall of the weights against all accesses as
+ * hits at distance 0, which skews small sizes when the hot lines are many.
+*/
+double shards_miss_ratio(const shards_t *sh, uint64_t blocks)
 {
-  size_t index = cache->start;
+  double hits = 0.0;
+  int k = __builtin_ctzll(blocks);
+  double ratio;
 
-  if (index == cache->end && !cache->is_full) {
-    // print_cache_miss(access);
-    return 0;
+  if (sh->weight == 0.0) {
+    return 0.0;
+  }
+  for (int b = 0; b <= k && b < 64; b++) {
+    hits += sh->hist[b];
   }
+  ratio = 1.0 - hits / sh->weight;
+  return (ratio < 0.0) ? 0.0 : (ratio > 1.0) ? 1.0 : ratio;
+}
 
-  do {
-    /* First check that valid bit is set */
-    if (cache->block[index].valid == true) {
-      /* Next, compare the tags */
-      if (cache->block[index].tag == access->tag) {
-        // print_cache_hit(access);
-        return 1;
+/* Largest cache size of a miss ratio curve */
+#define MRC_MAX_SIZE (64ULL << 30)
+
+/**
+ * Computes the LRU miss ratio curve of fully associative caches from 1 KB
+ * to MRC_MAX_SIZE in a single pass over the trace, sampling at most
+ * max_lines lines of every stack. A split cache gives each access type
+ * its own stack and half of the size.
+*/
+int run_mrc(const char *trace_path, cache_org_t cache_org, uint32_t block_size,
+            uint32_t max_lines)
+{
+  shards_t sh[2];
+  trace_t trace;
+  static access_batch_t batch;
+  const uint32_t offset = countBits(block_size);
+  int stacks = (cache_org == uc) ? 1 : 2;
+
+  for (int i = 0; i < stacks; i++) {
+    if (shards_init(&sh[i], max_lines)) {
+      if (i) {
+        shards_deinit(&sh[0]);
       }
+      return -1;
     }
-    index = (index + 1) % cache->length;
-  } while ( index != cache->end );
-
-  /* Cache miss */
-  return 0;
-}
+  }
 
-void transfer_address_to_cache(cache_t *cache, const mem_access_t *access)
-{
+  if (trace_open(&trace, trace_path)) {
+    printf("Unable to open the trace file\n");
+    for (int i = 0; i < stacks; i++) {
+      shards_deinit(&sh[i]);
+    }
+    return -1;
+  }
 
-  /* Check if cache is full */
-  if (cache->is_full) {
-    /* update start, must evict */
-    cache->start = (cache->start + 1) % cache->length;
-    cache_statistics.evicts++;
+  while (trace_read_batch(&trace, &batch) > 0) {
+    for (size_t i = 0; i < batch.len; i++) {
+      shards_access(&sh[(cache_org == uc) ? 0 : batch.type[i]],
+                    batch.address[i] >> offset);
+    }
   }
+  trace_close(&trace);
 
-  /* Transfer address, ignoring offset bytes for now */
-  cache->block[cache->end].valid = true;
-  cache->block[cache->end].tag = access->tag;
+  uint64_t accesses = sh[0].accesses + ((stacks == 2) ? sh[1].accesses : 0);
 
-  /* Update end pointer, this will wrap around to the
-  beginning once the full length of the cache is reached */
-  cache->end = (cache->end + 1) % cache->length;
+  printf("SHARDS miss ratio curve, fully associative LRU %s cache\n",
+         (cache_org == uc) ? "unified" : "split");
+  printf("Accesses: %" PRIu64 ", sampling rate: %.6f", accesses,
+         (double)sh[0].threshold / SHARDS_MODULUS);
+  if (stacks == 2) {
+    printf(" (instructions), %.6f (data)", (double)sh[1].threshold / SHARDS_MODULUS);
+  }
+  printf("\n\n%-10s %12s %10s\n", "Size", "Blocks", "Miss Ratio");
+  for (uint64_t size = 1024; size <= MRC_MAX_SIZE; size <<= 1) {
+    uint64_t blocks = size / block_size / stacks;
+    double misses = 0.0;
+    char label[24];
 
-  cache->is_full = (cache->end == cache->start);
-}
+    for (int i = 0; i < stacks; i++) {
+      misses += shards_miss_ratio(&sh[i], blocks) * sh[i].accesses;
+    }
+    snprintf(label, sizeof(label), "%" PRIu64 "%c", size >> ((size >= (1ULL << 30)) ? 30 :
+             (size >= (1ULL << 20)) ? 20 : 10),
+             (size >= (1ULL << 30)) ? 'G' : (size >= (1ULL << 20)) ? 'M' : 'K');
+    printf("%-10s %12" PRIu64 " %10.4f\n", label, blocks,
+           accesses ? misses / accesses : 0.0);
+  }
 
-/**
- * A fully associative cache will be treated as a ring buffer
-*/
-int access_cache_fa(cache_t *cache, const mem_access_t *access)
-{
-  /* Iterate through all cache entries */
-  if (is_address_in_fa_cache(cache, access)) {
-    /* Cache hit */
-    return 1;
-  } else { /* Miss */
-    transfer_address_to_cache(cache, access);
-    return 0;
+  for (int i = 0; i < stacks; i++) {
+    shards_deinit(&sh[i]);
   }
+  return 0;
 }
 
 // #ifndef RUN_UNIT_TESTS
 void main(int argc, char** argv)
 {
-  int ret;
-  uint32_t cache_size;
-  uint32_t cache_length;
+  uint32_t assoc = 4;
+  uint32_t block = DEFAULT_BLOCK_SIZE;
+  const char *policy = "fifo";
+  const char *write = "wb";
+  const char *prefetch = "none";
+  uint32_t victim = 0;
+  bool classify = false;
+  uint32_t sample = 0;
+  const char *checkpoint = NULL;
+  const char *restore = NULL;
+  uint64_t stop = 0;
+  uint64_t offset = 0;
+  const char *trace_path = "mem_trace.txt";
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-  cache_map_t cache_mapping;
-  cache_org_t cache_org;
-  cache_bits_t cache_bits;
-  cache_t cache;
-  cache_t cache_data;
-  cache_t cache_inst;
+  cache_config_t config;
+  cache_sim_t sim;
 
   // Reset statistics:
   memset(&cache_statistics, 0, sizeof(cache_stat_t));
 
+  /* Convert a text trace to the binary trace format and exit */
+  if (argc >= 4 && strcmp(argv[1], "--convert") == 0) {
+    trace_enc_t encoding = enc_delta;
+
+    if (argc > 4) {
+      if (strcmp(argv[4], "fixed32") == 0) {
+        encoding = enc_fixed32;
+      } else if (strcmp(argv[4], "fixed64") == 0) {
+        encoding = enc_fixed64;
+      } else if (strcmp(argv[4], "delta") != 0) {
+        printf("Unknown trace encoding\n");
+        exit(0);
+      }
+    }
+    exit(trace_convert(argv[2], argv[3], encoding) ? 1 : 0);
+  }
+
+  /* Simulate every configuration of a sweep file in one trace pass */
+  if (argc >= 3 && strcmp(argv[1], "--sweep") == 0) {
+    for (int i = 3; i < argc; i++) {
+      if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+        threads = atoi(argv[++i]);
+      } else {
+        trace_path = argv[i];
+      }
+    }
+    exit(run_sweep(argv[2], trace_path, (threads > 0) ? threads : 1) ? 1 : 0);
+  }
+
+  /* Simulate a multi-level hierarchy in one trace pass */
+  if (argc >= 3 && strcmp(argv[1], "--hierarchy") == 0) {
+    if (argc > 3) {
+      trace_path = argv[3];
+    }
+    exit(run_hierarchy(argv[2], trace_path) ? 1 : 0);
+  }
+
+  /* Simulate the coherent private caches of several cores in one pass */
+  if (argc >= 4 && strcmp(argv[1], "--coherence") == 0) {
+    exit(run_coherence(argv[2], (const char *const *)&argv[3], argc - 3) ? 1 : 0);
+  }
+
+  /* LRU hit rates of every fully associative size in one trace pass */
+  if (argc >= 2 && strcmp(argv[1], "--stack-distance") == 0) {
+    cache_org_t org = uc;
+
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "uc") == 0) {
+        org = uc;
+      } else if (strcmp(argv[i], "sc") == 0) {
+        org = sc;
+      } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+        block = atoi(argv[++i]);
+      } else {
+        trace_path = argv[i];
+      }
+    }
+    if (verify_block_size(block)) {
+      exit(0);
+    }
+    exit(run_stack_distance(trace_path, org, block) ? 1 : 0);
+  }
+
+  /* LRU miss ratio curve from KB to GB sizes in constant memory */
+  if (argc >= 2 && strcmp(argv[1], "--mrc") == 0) {
+    cache_org_t org = uc;
+    uint32_t lines = SHARDS_DEFAULT_LINES;
+
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "uc") == 0) {
+        org = uc;
+      } else if (strcmp(argv[i], "sc") == 0) {
+        org = sc;
+      } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+        block = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--lines") == 0 && i + 1 < argc) {
+        lines = atoi(argv[++i]);
+      } else {
+        trace_path = argv[i];
+      }
+    }
+    if (verify_block_size(block)) {
+      exit(0);
+    }
+    exit(run_mrc(trace_path, org, block, lines) ? 1 : 0);
+  }
+
   /* Read command-line parameters and initialize:
    * cache_size, cache_mapping cache_org, also optional input file
    */
   if (argc < 4) { /* argc should be 2 for correct execution */
     printf(
-        "Usage: ./cache_sim [cache size: 128-4096] [cache mapping: dm|fa] "
-        "[cache organization: uc|sc] <path_to_trace_file>\n");
+        "Usage: ./cache_sim [cache size: 128-64M] [cache mapping: dm|fa|sa] "
+        "[cache organization: uc|sc] [--ways <n>] "
+        "[--policy fifo|lru|plru|bitplru|random|lfu|srrip] [--write wb|wt|wb-nwa|wt-nwa] "
+        "[--block <16-256>] [--prefetch none|next|stride|stream] "
+        "[--victim <blocks>] [--classify] [--sample <1 in n sets>] [--threads <n>] "
+        "[--restore <checkpoint>] [--stop <accesses>] [--checkpoint <checkpoint>] "
+        "[--file] <path_to_trace_file|->\n"
+        "       ./cache_sim --sweep <config_file> [--threads <n>] <path_to_trace_file>\n"
+        "       ./cache_sim --hierarchy <config_file> <path_to_trace_file>\n"
+        "       ./cache_sim --coherence <config_file> <core_tagged_trace|trace_per_core...>\n"
+        "       ./cache_sim --stack-distance [uc|sc] [--block <16-256>] <path_to_trace_file>\n"
+        "       ./cache_sim --mrc [uc|sc] [--block <16-256>] [--lines <sampled lines>] "
+        "<path_to_trace_file>\n"
+        "       ./cache_sim --convert <text_trace> <binary_trace> [delta|fixed32|fixed64]\n"
+        "Traces are text or binary, optionally gzip, zstd, xz or bzip2 compressed, "
+        "- reads one from stdin\n");
     exit(0);
   } else {
     /* argv[0] is program name, parameters start with argv[1] */
 
-    /* Set cache size */
-    cache_size = atoi(argv[1]);
-    if (verify_cache_size(cache_size)) {
-      exit(0);
-    }
-
+    /* A single configuration only splits its sets over threads on request */
+    threads = 1;
 
-    /* Set Cache Mapping */
-    if (strcmp(argv[2], "dm") == 0) {
-      cache_mapping = dm;
-    } else if (strcmp(argv[2], "fa") == 0) {
-      cache_mapping = fa;
-    } else {
-      printf("Unknown cache mapping\n");
-      exit(0);
+    /* Optional arguments */
+    for (int i = 4; i < argc; i++) {
+      if (strcmp(argv[i], "--ways") == 0 && i + 1 < argc) {
+        assoc = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+        policy = argv[++i];
+      } else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+        write = argv[++i];
+      } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+        block = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+        prefetch = argv[++i];
+      } else if (strcmp(argv[i], "--victim") == 0 && i + 1 < argc) {
+        victim = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--classify") == 0) {
+        classify = true;
+      } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+        sample = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+        threads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+        checkpoint = argv[++i];
+      } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+        restore = argv[++i];
+      } else if (strcmp(argv[i], "--stop") == 0 && i + 1 < argc) {
+        stop = strtoull(argv[++i], NULL, 10);
+      } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+        trace_path = argv[++i];
+      } else {
+        trace_path = argv[i];
+      }
     }
 
-    /* Set Cache Organization */
-    if (strcmp(argv[3], "uc") == 0) {
-      cache_org = uc;
-    } else if (strcmp(argv[3], "sc") == 0) {
-      cache_org = sc;
-    } else {
-      printf("Unknown cache organization\n");
+    /* Cache size, mapping and organization */
+    if (parse_cache_config(&config, argv[1], argv[2], argv[3], assoc) ||
+        parse_cache_policy(&config.policy, policy) ||
+        parse_write_policy(&config.write, write) ||
+        parse_prefetcher(&config.prefetch, prefetch)) {
       exit(0);
     }
+    config.block = block;
+    config.victim = victim;
+    config.classify = classify;
+    config.sample = sample;
   }
 
-  /** Allocate memory for cache **/
-  cache_length = get_cache_length(cache_size, cache_org);
-  if (cache_org == uc) {
-    if (cache_init(&cache, cache_length)) {
-      printf("Failed to allocate memory for unified cache\n");
-      exit(0);
-    }
-  } else { /* split cache */
-    if (cache_init(&cache_data, cache_length)) {
-      printf("Failed to allocate memory for data cache\n");
-      exit(0);
-    }
-    if (cache_init(&cache_inst, cache_length)) {
-      printf("Failed to allocate memory for instruction cache\n");
-      exit(0);
-    }
+  if (cache_sim_init(&sim, &config)) {
+    exit(0);
   }
 
-  /* Get cache bits, which will be used in placing memory transfers */
-  set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+  /* Start from warm caches instead of simulating the trace up to there */
+  if (restore && cache_sim_restore(&sim, restore, &offset)) {
+    exit(1);
+  }
 
   /* Open the file to read memory traces.
-   * Either user provided with argv[4], or mem_traces.txt
+   * Either user provided after the cache parameters, or mem_traces.txt
    */
-  FILE* ptr_file;
-  if (argv[4]) {
-    ptr_file = fopen(argv[4], "r");
-  } else {
-    ptr_file = fopen("mem_trace.txt", "r");
-  }
-  if (!ptr_file) {
+  trace_t trace;
+  if (trace_open(&trace, trace_path)) {
     printf("Unable to open the trace file\n");
     exit(1);
   }
+  if (trace_skip(&trace, offset) < offset) {
+    printf("The trace is shorter than the checkpoint offset\n");
+    exit(1);
+  }
+  trace.limit = stop;
 
-  /* Loop until whole trace file has been read */
-  mem_access_t access;
-  while (1) {
-    access = read_transaction(ptr_file);
-    // If no transactions left, break out of loop
-    if (access.address == 0) break;
-    // printf("%d %x\n", access.accesstype, access.address);
-    cache_statistics.accesses++;
-    set_access_identifiers(&access, cache_bits);
-
-    /** Perform cache access **/
-    if (cache_mapping == dm) {
-      if (cache_org == uc) {
-        ret = access_cache_dm(&cache, &access);
-      } else { /* split cache */
-        if (access.accesstype == instruction) {
-          ret = access_cache_dm(&cache_inst, &access);
-        } else { /* Data */
-          ret = access_cache_dm(&cache_data, &access);
-        }
-      }
-    } else { /* fully associative */
-      if (cache_org == uc) {
-        ret = access_cache_fa(&cache, &access);
-      } else { /* split cache */
-        if (access.accesstype == instruction) {
-          ret = access_cache_fa(&cache_inst, &access);
-        } else { /* Data */
-          ret = access_cache_fa(&cache_data, &access);
-        }
-      }
-    }
-
-    cache_statistics.hits += ret;
+  /* Loop until whole trace file has been read, a batch at a time */
+  if (cache_sim_run_trace(&sim, &trace, (threads > 0) ? threads : 1)) {
+    exit(1);
   }
 
-  if (cache_org == uc) {
-    cache_deinit(&cache);
-  } else {
-    cache_deinit(&cache_data);
-    cache_deinit(&cache_inst);
+  if (checkpoint && cache_sim_save(&sim, checkpoint)) {
+    exit(1);
   }
 
+  /* Sampling details are freed with the simulation */
+  double hit_rate_ci = cache_sim_hit_rate_ci(&sim);
+  uint32_t sampled = sim.sampler ? sim.sampler->sampled : 0;
+  uint32_t sets = sim.sampler ? sim.sampler->sets : 0;
+
+  cache_sim_deinit(&sim);
+  cache_statistics = sim.stats;
+
   /* Print the statistics */
   // DO NOT CHANGE THE FOLLOWING LINES!
   printf("\nCache Statistics\n");
@@ -471,7 +6145,30 @@ void main(int argc, char** argv)
   // DO NOT CHANGE UNTIL HERE
   // You can extend the memory statistic printing if you like!
   printf("Evicts:     %ld\n", cache_statistics.evicts);
+  printf("Writes:     %ld\n", cache_statistics.writes);
+  printf("Writebacks: %ld\n", cache_statistics.writebacks);
+  printf("Read Bytes:  %ld\n", cache_statistics.read_bytes);
+  printf("Write Bytes: %ld\n", cache_statistics.write_bytes);
+  if (config.prefetch != pf_none) {
+    printf("Prefetches:         %ld\n", cache_statistics.prefetches);
+    printf("Useful Prefetches:  %ld\n", cache_statistics.useful_prefetches);
+    printf("Useless Prefetches: %ld\n", cache_statistics.useless_prefetches);
+    printf("Prefetch Evicts:    %ld\n", cache_statistics.prefetch_evicts);
+    printf("Pollution Misses:   %ld\n", cache_statistics.pollution_misses);
+  }
+  if (config.victim) {
+    printf("Victim Hits:        %ld\n", cache_statistics.victim_hits);
+  }
+  if (config.classify) {
+    printf("Compulsory Misses:  %ld\n", cache_statistics.compulsory_misses);
+    printf("Capacity Misses:    %ld\n", cache_statistics.capacity_misses);
+    printf("Conflict Misses:    %ld\n", cache_statistics.conflict_misses);
+  }
+  if (config.sample > 1) {
+    printf("Sampled Sets:       %u of %u\n", sampled, sets);
+    printf("Hit Rate 95%% CI:    +/- %.4f\n", hit_rate_ci);
+  }
   /* Close the trace file */
-  fclose(ptr_file);
+  trace_close(&trace);
 }
 // #endif /* RUN_UNIT_TESTS */
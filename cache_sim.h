@@ -3,28 +3,103 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
 
-#define MASK(n) ((1U << (n)) - 1)
+#define MASK(n) (((n) >= 64) ? UINT64_MAX : (1ULL << (n)) - 1)
 
-/* direct mapped or fully associative*/
-typedef enum { dm, fa } cache_map_t;
+/* Valid bits of all blocks are packed 64 to a word */
+#define BLOCK_VALID(cache, i) (((cache)->valid[(i) >> 6] >> ((i) & 63)) & 1)
+#define SET_BLOCK_VALID(cache, i) ((cache)->valid[(i) >> 6] |= 1ULL << ((i) & 63))
+#define CLEAR_BLOCK_VALID(cache, i) ((cache)->valid[(i) >> 6] &= ~(1ULL << ((i) & 63)))
+
+/* direct mapped, fully associative or N-way set associative */
+typedef enum { dm, fa, sa } cache_map_t;
 /* Unified cache or split cache (instruction/data) */
 typedef enum { uc, sc } cache_org_t;
 typedef enum { instruction, data } access_t;
+/* Replacement policy of the associative mappings */
+typedef enum {
+  rp_fifo, rp_lru, rp_tree_plru, rp_bit_plru, rp_random, rp_lfu, rp_srrip
+} cache_policy_t;
+
+/* Write hit and write miss policy:
+ *  wp_wb:     write-back, write-allocate
+ *  wp_wt:     write-through, write-allocate
+ *  wp_wb_nwa: write-back, no-write-allocate
+ *  wp_wt_nwa: write-through, no-write-allocate
+ */
+typedef enum { wp_wb, wp_wt, wp_wb_nwa, wp_wt_nwa } write_policy_t;
+
+/* Hardware prefetcher of a cache:
+ *  pf_next_line: tagged next-line, on a miss or the first use of a
+ *                prefetched block the next block is prefetched
+ *  pf_stride:    stride detection per 4KB region, traces have no PCs
+ *  pf_stream:    stream buffers next to the cache, allocated on misses
+ */
+typedef enum { pf_none, pf_next_line, pf_stride, pf_stream } prefetch_t;
 
-typedef struct cache_block_t {
-  uint8_t byte[64];
-  uint32_t tag;
-  bool valid;
-} cache_block_t;
+/* FIFO ring of a single set, used by the associative mappings. The
+ * other policies only use it to fill the empty ways of a set in order.
+ * holes counts ways invalidated by a lower level of a hierarchy, they
+ * are refilled before anything is evicted.
+ */
+typedef struct cache_set_t {
+  uint32_t start;
+  uint32_t end;
+  bool is_full;
+  uint32_t holes;
+} cache_set_t;
 
 typedef struct cache_t {
-  /* start, end, and is_full to be used only with fully associative FIFO mechanism */
-  uint8_t length;
-  uint8_t start;
-  uint8_t end;
-  uint8_t is_full;
-  cache_block_t *block;
+  uint32_t length;
+  uint32_t sets;
+  uint32_t ways;
+  cache_set_t *set;
+  /* Tag only metadata of sets * ways blocks, the ways of a set are
+   * contiguous. Block data is never simulated, so it is not stored.
+   * Tags are packed in TAG_BITS bits, the low 32 in tag and the rest in
+   * tag_hi, which is only allocated once a tag does not fit 32 bits.
+   */
+  uint32_t *tag;
+  uint16_t *tag_hi;
+  uint64_t *valid;
+  /* Hashed tag index, only allocated for highly associative caches.
+   * Each set owns hash_size slots holding (way + 1), 0 marks an empty slot.
+   */
+  uint32_t hash_size;
+  uint8_t hash_shift;
+  uint32_t *hash;
+  /* Replacement state, only what the policy needs is allocated:
+   *  lru:       circular recency list per set, meta holds the previous
+   *             and next way of every block, set_state the most recent way
+   *  tree_plru: ways - 1 tree bits per set in bits, node n at bit n
+   *  bit_plru:  one MRU bit per block in bits, set_state counts them
+   *  lfu:       access count of every block in meta
+   *  srrip:     re-reference prediction value of every block in meta
+   *  random:    xorshift state in rng
+   */
+  cache_policy_t policy;
+  uint32_t *meta;
+  uint32_t *set_state;
+  uint64_t *bits;
+  uint64_t rng;
+  /* Tag of the block evicted by the last eviction */
+  uint64_t victim;
+  /* Dirty bits like valid, only allocated for write-back caches. Write
+   * misses bypass the cache without write-allocate.
+   */
+  uint64_t *dirty;
+  bool write_allocate;
+  uint64_t writebacks;
+  uint64_t write_around;
+  /* Evictions of this cache, kept per instance so caches can be simulated
+   * on different threads
+   */
+  uint64_t evicts;
+  /* Checkpoint the arrays may be mapped from, those are not freed */
+  const uint8_t *map;
+  size_t map_size;
 } cache_t;
 
 typedef struct cache_bits_t {
@@ -34,37 +109,577 @@ typedef struct cache_bits_t {
 } cache_bits_t;
 
 typedef struct mem_access_t {
-  uint32_t address;
-  uint32_t tag;
+  uint64_t address;
+  uint64_t tag;
   uint32_t index;
   uint32_t offset;
   access_t accesstype;
+  bool write;
+  uint8_t core;
 } mem_access_t;
 
+/* Record encodings of the binary trace format */
+typedef enum { enc_fixed32, enc_fixed64, enc_delta } trace_enc_t;
+
+/* Header of a binary trace file, followed by the records.
+ *  enc_fixed32: uint32_t addresses, then a bitmap of access types and a
+ *               bitmap of writes
+ *  enc_fixed64: uint64_t (address << 2 | write << 1 | access type)
+ *  enc_delta:   LEB128 varint of (zigzag(address - previous) << 2 | write << 1
+ *               | access type)
+ * Version 1 traces have no write bit and bitmap, all accesses are reads.
+ */
+typedef struct trace_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t encoding;
+  uint64_t count;
+} trace_header_t;
+
+/* A memory trace, either text read in large blocks or binary mapped in
+ * memory. A binary trace read from a pipe is held in memory instead,
+ * map_owned tells to free it. Compressed traces are read from the output
+ * of a decompressor process, the feeder thread copies the compressed
+ * input from src_fd into it. records counts the records read or skipped,
+ * batches end at limit records unless it is 0.
+ */
+typedef struct trace_t {
+  int fd;
+  uint8_t *buf;
+  size_t buf_len;
+  size_t buf_pos;
+  bool eof;
+  const uint8_t *map;
+  size_t map_size;
+  bool map_owned;
+  pid_t child;
+  int src_fd;
+  int feed_fd;
+  pthread_t feeder;
+  bool feeding;
+  uint8_t prefix[8];
+  size_t prefix_len;
+  trace_enc_t encoding;
+  uint64_t count;
+  uint64_t pos;
+  const uint8_t *cursor;
+  const uint8_t *types;
+  const uint8_t *writes;
+  uint8_t flag_bits;
+  uint64_t prev;
+  uint64_t records;
+  uint64_t limit;
+} trace_t;
+
+/* Number of records read from the trace and simulated at a time */
+#define TRACE_BATCH 4096
+
+/* A batch of parsed accesses in structure of arrays form. It is only
+ * read while simulating, so many configurations can share it. writes
+ * counts the set entries of write[], core[] is only used by multi-core
+ * simulations.
+ */
+typedef struct access_batch_t {
+  size_t len;
+  size_t writes;
+  uint64_t address[TRACE_BATCH];
+  uint8_t type[TRACE_BATCH];
+  uint8_t write[TRACE_BATCH];
+  uint8_t core[TRACE_BATCH];
+} access_batch_t;
+
+/* Tag and index of a batch, decoded for one configuration in one tight
+ * loop. Byte offsets do not affect hits and are not decoded.
+ */
+typedef struct access_ids_t {
+  uint64_t tag[TRACE_BATCH];
+  uint32_t index[TRACE_BATCH];
+} access_ids_t;
+
+/* Traffic to the next level in bytes: read_bytes is filled blocks,
+ * write_bytes is written back blocks and written through stores
+ */
 typedef struct cache_stat_t {
   uint64_t accesses;
   uint64_t hits;
+  uint64_t evicts;
+  uint64_t writes;
+  uint64_t writebacks;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+  /* useful: prefetched blocks later used, useless: dropped unused,
+   * prefetch_evicts: blocks evicted by prefetches, pollution_misses:
+   * demand misses on blocks a prefetch evicted
+   */
+  uint64_t prefetches;
+  uint64_t useful_prefetches;
+  uint64_t useless_prefetches;
+  uint64_t prefetch_evicts;
+  uint64_t pollution_misses;
+  /* 3C classification of the misses: compulsory: first access to the
+   * block, conflict: a fully associative LRU cache of the same size hits,
+   * capacity: it misses as well. victim_hits: misses served by the victim
+   * cache, counted as hits.
+   */
+  uint64_t compulsory_misses;
+  uint64_t capacity_misses;
+  uint64_t conflict_misses;
+  uint64_t victim_hits;
 } cache_stat_t;
 
-int countBits(uint8_t n);
+/* LRU stack distance analysis. Every line marks the time of its last
+ * access in a Fenwick tree, so the number of distinct lines touched
+ * since then is a prefix sum. Times are renumbered when the tree fills.
+ */
+#define STACK_DIST_MIN_CAPACITY (1U << 20)
+
+typedef struct stack_dist_t {
+  uint32_t *tree;
+  uint32_t capacity;
+  uint32_t now;
+  uint32_t active;
+  /* line + 1 -> time of last access, open addressing, 0 key is empty */
+  uint64_t *keys;
+  uint32_t *times;
+  size_t map_size;
+  /* hist[0]: distance 0, hist[k]: distances [2^(k-1), 2^k) */
+  uint64_t hist[34];
+  uint64_t accesses;
+  uint64_t cold;
+} stack_dist_t;
+
+/* Distance of first accesses */
+#define STACK_DIST_COLD UINT32_MAX
+
+/* SHARDS miss ratio curves: only lines whose hash modulo SHARDS_MODULUS
+ * is below threshold are sampled, their stack distances are scaled up by
+ * the inverse sampling rate. At most max_lines are tracked, a max-heap
+ * of their hashes finds the lines to drop when the threshold is lowered
+ * to keep it so, so memory is constant whatever the footprint.
+ */
+#define SHARDS_MODULUS (1U << 24)
+#define SHARDS_DEFAULT_LINES (1U << 15)
+
+typedef struct shards_entry_t {
+  uint64_t line;
+  uint32_t hash;
+} shards_entry_t;
+
+/* hist is like the one of stack_dist_t, but every sampled access weighs
+ * the inverse of the sampling rate it was sampled at. weight sums them
+ * over all sampled accesses.
+ */
+typedef struct shards_t {
+  stack_dist_t sd;
+  uint32_t threshold;
+  uint32_t max_lines;
+  shards_entry_t *heap;
+  uint32_t heap_len;
+  uint64_t accesses;
+  double hist[64];
+  double weight;
+} shards_t;
+
+/* Inclusion between the levels of a hierarchy:
+ *  nine:      non-inclusive non-exclusive, every level that missed is filled
+ *  inclusive: as nine, and a block evicted from a lower level is invalidated
+ *             in the levels above it
+ *  exclusive: only the first level is filled, lower levels hold the victims
+ *             of the level above them
+ */
+typedef enum { nine, inclusive, exclusive } inclusion_t;
+
+/* Geometry of one simulated cache, assoc is only used for set associative */
+typedef struct cache_config_t {
+  uint32_t size;
+  cache_map_t mapping;
+  cache_org_t org;
+  uint32_t assoc;
+  cache_policy_t policy;
+  write_policy_t write;
+  uint32_t block;
+  prefetch_t prefetch;
+  /* Blocks of the victim cache, 0 for none */
+  uint32_t victim;
+  bool classify;
+  /* Simulate about 1 in sample sets, 0 or 1 simulates all */
+  uint32_t sample;
+} cache_config_t;
+
+/* Prefetcher parameters */
+#define PREFETCH_DEGREE 2
+#define STRIDE_TABLE_SIZE 64
+#define STRIDE_REGION_BITS 12
+#define STREAM_BUFFERS 4
+#define STREAM_DEPTH 4
+#define POLLUTION_FILTER_SIZE 4096
+
+/* Last block and stride seen in a region, region + 1 so 0 is empty */
+typedef struct stride_entry_t {
+  uint64_t region;
+  uint64_t last;
+  int64_t stride;
+  uint32_t confidence;
+} stride_entry_t;
+
+/* Sequential blocks head to head + count - 1 waiting in a stream buffer */
+typedef struct stream_buffer_t {
+  uint64_t head;
+  uint32_t count;
+  uint64_t used;
+} stream_buffer_t;
+
+/* Prefetcher of one cache. prefetched marks the blocks a prefetch filled
+ * that were not used yet, filter holds blocks + 1 evicted by prefetches.
+ */
+typedef struct prefetcher_t {
+  prefetch_t kind;
+  uint64_t *prefetched;
+  uint64_t *filter;
+  stride_entry_t stride[STRIDE_TABLE_SIZE];
+  stream_buffer_t stream[STREAM_BUFFERS];
+  uint64_t clock;
+} prefetcher_t;
+
+#define VICTIM_MAX_BLOCKS 64
+
+/* Fully associative LRU buffer of the blocks evicted from a cache, block
+ * + 1 so 0 is empty. A miss found here swaps the block with the victim of
+ * its fill. Entries are clean, dirty blocks are written back as they
+ * leave the cache.
+ */
+typedef struct victim_cache_t {
+  uint64_t block[VICTIM_MAX_BLOCKS];
+  uint64_t used[VICTIM_MAX_BLOCKS];
+  uint32_t blocks;
+  uint64_t clock;
+} victim_cache_t;
+
+#define SEEN_MIN_SIZE (1U << 16)
+#define SEEN_LOOKAHEAD 8
+
+/* Block + 1 of a block seen before, 0 is empty, and the shadow way + 1
+ * holding it or 0
+ */
+typedef struct seen_entry_t {
+  uint64_t key;
+  uint32_t way;
+} seen_entry_t;
+
+/* 3C miss classifier of one cache, a fully associative LRU shadow cache of
+ * as many blocks and the set of blocks seen so far in one open addressing
+ * map. The shadow keeps the map slot of every way and a circular recency
+ * list of ways, head is the most recent.
+ */
+typedef struct miss_classifier_t {
+  seen_entry_t *seen;
+  size_t map_size;
+  size_t count;
+  uint32_t length;
+  uint32_t filled;
+  uint32_t head;
+  size_t *slot;
+  uint32_t *prev;
+  uint32_t *next;
+  bool write_allocate;
+} miss_classifier_t;
+
+struct cache_sim_t;
+
+/* Set sampling: only sets with a group simulate their accesses, about 1
+ * in rate by a hash of the set index. The sampled sets are dealt into
+ * SAMPLE_GROUPS groups in index order, each simulated from its own batch
+ * with the configuration's kernel, so the spread of the group hit rates
+ * bounds the error of the extrapolated hit rate.
+ */
+#define SAMPLE_GROUPS 16
+
+typedef struct set_sampler_t {
+  uint32_t rate;
+  uint32_t sets;
+  uint32_t sampled;
+  /* Group + 1 of every set, 0 if it is not sampled */
+  uint8_t *group;
+  access_batch_t *batch;
+  uint64_t (*kernel)(struct cache_sim_t *sim, const access_batch_t *batch);
+  uint64_t accesses[SAMPLE_GROUPS];
+  uint64_t hits[SAMPLE_GROUPS];
+} set_sampler_t;
+
+/* Batches of accesses a partition can queue per round */
+#define PARTITION_QUEUE 16
+
+struct partition_pool_t;
+
+/* Set partitioned simulation of a configuration: a view of it simulates
+ * the accesses to its range of sets. The reader routes them to one queue
+ * while the view simulates the other, queued counts the accesses in each.
+ */
+typedef struct partition_t {
+  access_batch_t *queue[2];
+  size_t queued[2];
+  struct partition_pool_t *pool;
+} partition_t;
+
+/* One simulated cache configuration and its statistics. cache[] is
+ * indexed by access type, a unified cache only uses cache[0] and both
+ * entries of caches[] point to it. kernel simulates a batch and returns
+ * its hits, it is specialized for the configuration by cache_sim_init().
+ */
+typedef struct cache_sim_t {
+  cache_config_t config;
+  uint32_t length;
+  uint32_t ways;
+  cache_bits_t bits;
+  cache_t cache[2];
+  cache_t *caches[2];
+  access_ids_t *ids;
+  /* Indexed like cache[], NULL when not configured */
+  prefetcher_t *prefetcher;
+  victim_cache_t *victim_cache;
+  miss_classifier_t *classifier;
+  /* NULL unless sampling, statistics are then extrapolated */
+  set_sampler_t *sampler;
+  /* NULL unless this is a view of a set partitioned simulation */
+  partition_t *partition;
+  cache_stat_t stats;
+  uint64_t (*kernel)(struct cache_sim_t *sim, const access_batch_t *batch);
+  /* Checkpoint the caches were restored from, NULL if none */
+  void *snapshot;
+  size_t snapshot_size;
+} cache_sim_t;
+
+/* Checkpoint of the caches of a simulation: the header, then for every
+ * cache its checkpoint_cache_t and its arrays, each starting on a
+ * CHECKPOINT_ALIGN boundary so they are used in place once mapped. The
+ * structures are stored as laid out in memory, a checkpoint is only read
+ * back by the build that wrote it.
+ */
+#define CHECKPOINT_MAGIC "CSIMCKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGN 64
+#define CHECKPOINT_ARRAYS 9
+
+typedef struct checkpoint_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t caches;
+  cache_config_t config;
+  cache_stat_t stats;
+  /* Trace records simulated before the checkpoint */
+  uint64_t offset;
+} checkpoint_header_t;
+
+/* Counters and policy state of one cache, tag_hi tells whether the high
+ * tag bits are stored
+ */
+typedef struct checkpoint_cache_t {
+  uint32_t tag_hi;
+  uint64_t rng;
+  uint64_t victim;
+  uint64_t writebacks;
+  uint64_t write_around;
+  uint64_t evicts;
+} checkpoint_cache_t;
+
+#define MAX_LEVELS 4
+
+/* Cache hierarchy, level[0] is closest to the core. Latencies are the hit
+ * latencies in cycles of every level and of memory.
+ */
+typedef struct hierarchy_t {
+  uint32_t levels;
+  cache_sim_t level[MAX_LEVELS];
+  uint32_t latency[MAX_LEVELS];
+  uint32_t memory_latency;
+  inclusion_t inclusion;
+  uint64_t memory_accesses;
+} hierarchy_t;
+
+/* Coherence protocols of the private caches of a multi-core simulation */
+typedef enum { msi, mesi, moesi } protocol_t;
+
+/* Coherence state of every block of a private cache. A block invalidated
+ * by another cache keeps its tag as st_invalidated until its way is
+ * refilled, a miss on it is a coherence miss.
+ */
+typedef enum {
+  st_invalid, st_invalidated, st_shared, st_exclusive, st_owned, st_modified
+} block_state_t;
+
+/* Private caches of all cores are bits of a 64 bit holder mask */
+#define MAX_COHERENT_CACHES 64
+
+/* Directory entry of a cached block, key is block + 1 so 0 is empty */
+typedef struct dir_entry_t {
+  uint64_t key;
+  uint64_t holders;
+} dir_entry_t;
+
+/* A core and its private caches, state[] is indexed like cache[] of sim.
+ * invalidations counts the blocks other caches invalidated in them.
+ */
+typedef struct coherence_core_t {
+  cache_sim_t sim;
+  uint8_t *state[2];
+  uint64_t coherence_misses;
+  uint64_t invalidations;
+} coherence_core_t;
+
+/* Private caches of cores kept coherent by a directory. It holds a mask
+ * of the caches holding every cached block, so no cache is snooped that
+ * does not hold the block. Cache i of core c is bit c * caches + i.
+ * Bus transactions:
+ *  bus_reads:           read misses (BusRd)
+ *  bus_read_exclusives: write misses (BusRdX)
+ *  bus_upgrades:        writes to shared or owned blocks (BusUpgr)
+ *  writebacks:          dirty blocks written to memory, when evicted and
+ *                       when a read shares a modified block (MSI, MESI)
+ * transfers counts misses served by the cache holding the block dirty.
+ */
+typedef struct coherence_t {
+  protocol_t protocol;
+  uint32_t cores;
+  uint32_t caches;
+  coherence_core_t *core;
+  dir_entry_t *dir;
+  size_t dir_size;
+  uint64_t bus_reads;
+  uint64_t bus_read_exclusives;
+  uint64_t bus_upgrades;
+  uint64_t writebacks;
+  uint64_t transfers;
+} coherence_t;
+
+int countBits(uint32_t n);
+
+bool is_power_of_two(uint32_t n);
+
+int verify_cache_size(uint32_t cache_size);
 
-uint32_t get_cache_length(uint32_t cache_size, cache_org_t cache_org);
+int verify_block_size(uint32_t block_size);
+
+uint32_t parse_cache_size(const char *arg);
+
+uint32_t get_cache_length(uint32_t cache_size, cache_org_t cache_org, uint32_t block_size);
+
+uint32_t get_cache_ways(uint32_t cache_length, cache_map_t cache_mapping, uint32_t assoc);
 
 void set_cache_bits(cache_bits_t *cache_bits,
                   uint32_t cache_length,
+                  uint32_t cache_ways,
                   cache_map_t cache_mapping,
-                  cache_org_t cache_org);
+                  cache_org_t cache_org,
+                  uint32_t block_size);
 
-int cache_init(cache_t *cache, uint8_t length);
+int cache_init(cache_t *cache, uint32_t length, uint32_t ways, cache_policy_t policy);
 
 void cache_deinit(cache_t *cache);
 
+int cache_set_write_policy(cache_t *cache, write_policy_t write);
+
 void set_access_identifiers(mem_access_t *access, cache_bits_t cache_bits);
 
+void set_access_identifiers_batch(const access_batch_t *batch,
+                                  cache_bits_t cache_bits,
+                                  access_ids_t *ids);
+
+uint64_t access_cache_batch(cache_t *const caches[2],
+                            cache_map_t cache_mapping,
+                            const access_batch_t *batch,
+                            const access_ids_t *ids);
+
 int access_cache_dm(cache_t *cache, const mem_access_t *access);
 
 int access_cache_fa(cache_t *cache, const mem_access_t *access);
 
+int access_cache_sa(cache_t *cache, const mem_access_t *access);
+
+int cache_lookup(const cache_t *cache, uint32_t index, uint64_t tag);
+
 int is_address_in_fa_cache(const cache_t *cache, const mem_access_t *access);
 
 void transfer_address_to_cache(cache_t *cache, const mem_access_t *access);
+
+int cache_fill(cache_t *cache, uint32_t index, uint64_t tag);
+
+int cache_invalidate(cache_t *cache, uint32_t index, uint64_t tag);
+
+int read_transaction(trace_t *trace, mem_access_t *access);
+
+int trace_open(trace_t *trace, const char *path);
+
+int trace_read(trace_t *trace, mem_access_t *access);
+
+size_t trace_read_batch(trace_t *trace, access_batch_t *batch);
+
+uint64_t trace_skip(trace_t *trace, uint64_t n);
+
+void trace_close(trace_t *trace);
+
+int trace_convert(const char *in_path, const char *out_path, trace_enc_t encoding);
+
+int parse_cache_config(cache_config_t *config, const char *size,
+                       const char *mapping, const char *org, uint32_t assoc);
+
+int parse_cache_policy(cache_policy_t *policy, const char *name);
+
+int parse_write_policy(write_policy_t *write, const char *name);
+
+int parse_prefetcher(prefetch_t *prefetch, const char *name);
+
+int cache_sim_init(cache_sim_t *sim, const cache_config_t *config);
+
+void cache_sim_deinit(cache_sim_t *sim);
+
+void cache_sim_run_batch(cache_sim_t *sim, const access_batch_t *batch);
+
+double cache_sim_hit_rate_ci(const cache_sim_t *sim);
+
+int cache_sim_run_trace(cache_sim_t *sim, trace_t *trace, uint32_t threads);
+
+int cache_sim_save(const cache_sim_t *sim, const char *path);
+
+int cache_sim_restore(cache_sim_t *sim, const char *path, uint64_t *offset);
+
+int run_sweep(const char *config_path, const char *trace_path, uint32_t threads);
+
+int hierarchy_init(hierarchy_t *hierarchy, const char *config_path);
+
+void hierarchy_deinit(hierarchy_t *hierarchy);
+
+void hierarchy_access(hierarchy_t *hierarchy, uint64_t address, access_t type);
+
+double hierarchy_amat(const hierarchy_t *hierarchy);
+
+int run_hierarchy(const char *config_path, const char *trace_path);
+
+int coherence_init(coherence_t *coh, const char *config_path, uint32_t cores);
+
+void coherence_deinit(coherence_t *coh);
+
+void coherence_access(coherence_t *coh, uint32_t core, uint64_t address,
+                      access_t type, bool write);
+
+int run_coherence(const char *config_path, const char *const *trace_paths, uint32_t count);
+
+int stack_dist_init(stack_dist_t *sd);
+
+void stack_dist_deinit(stack_dist_t *sd);
+
+uint32_t stack_dist_access(stack_dist_t *sd, uint64_t line);
+
+uint64_t stack_dist_hits(const stack_dist_t *sd, uint32_t blocks);
+
+int run_stack_distance(const char *trace_path, cache_org_t cache_org, uint32_t block_size);
+
+int shards_init(shards_t *sh, uint32_t max_lines);
+
+void shards_deinit(shards_t *sh);
+
+void shards_access(shards_t *sh, uint64_t line);
+
+double shards_miss_ratio(const shards_t *sh, uint64_t blocks);
+
+int run_mrc(const char *trace_path, cache_org_t cache_org, uint32_t block_size,
+            uint32_t max_lines);
@@ -5,7 +5,7 @@ TOP_LVL="$HOME/projects/cache_simulator"
 if [ -e "system_test" ]; then
     rm system_test
 fi
-gcc -o system_test $TOP_LVL/cache_sim.c
+gcc -pthread -o system_test $TOP_LVL/cache_sim.c -lm
 
 echo "Using mem_trace1.txt"
 echo " "
@@ -65,3 +65,60 @@ echo "4096B, FA, SC"
 ./system_test 4096 fa uc
 echo "Expected 5 accesses, 1 hit"
 echo "----"
+
+echo "--- Set Associative ---"
+
+echo "4096B, SA 4-way, UC"
+./system_test 4096 sa uc --ways 4
+echo "Expected 5 accesses, 1 hit"
+echo "----"
+
+echo "--- Sweep ---"
+
+echo "All of the above in one pass over mem_trace1.txt"
+./system_test --sweep testcases/sweep.cfg --threads 4 testcases/mem_trace1.txt
+echo "----"
+
+echo "--- Hierarchy ---"
+
+echo "4096B SA 4-way SC L1, 64KB SA 8-way UC L2, inclusive"
+./system_test --hierarchy testcases/hierarchy.cfg testcases/mem_trace1.txt
+echo "Expected L1 5 accesses, 1 hit, L2 4 accesses, 0 hits"
+echo "----"
+
+echo "--- Coherence ---"
+
+echo "2 cores, 4096B SA 4-way UC private caches, MESI"
+./system_test --coherence testcases/coherence.cfg testcases/cores.txt
+echo "Expected core 0 3 accesses, 1 hit, 1 coherence miss, core 1 2 accesses, 1 hit, 2 upgrades, 1 writeback"
+echo "----"
+
+echo "--- Write Policies ---"
+
+echo "128B, FA LRU, UC, write-back write-allocate"
+./system_test 128 fa uc --policy lru --write wb testcases/writes.txt
+echo "Expected 8 accesses, 2 hits, 1 writeback"
+echo "----"
+
+echo "--- Streaming ---"
+
+echo "4096B, SA 4-way, UC, gzip compressed trace on stdin"
+gzip -c testcases/mem_trace1.txt | ./system_test 4096 sa uc --ways 4 --threads 2 -
+echo "Expected 5 accesses, 1 hit"
+echo "----"
+
+echo "--- Checkpoint ---"
+
+echo "4096B, SA 4-way, UC, warm caches after 3 accesses restored from a checkpoint"
+./system_test 4096 sa uc --ways 4 --stop 3 --checkpoint checkpoint.bin testcases/mem_trace1.txt
+./system_test 4096 sa uc --ways 4 --restore checkpoint.bin testcases/mem_trace1.txt
+rm -f checkpoint.bin
+echo "Expected 3 accesses, then 5 accesses, 1 hit"
+echo "----"
+
+echo "--- Miss Ratio Curve ---"
+
+echo "SC, 64B blocks, every line tracked"
+./system_test --mrc sc testcases/mem_trace1.txt
+echo "Expected 5 accesses, 0.8000 miss ratio at every size"
+echo "----"
@@ -13,6 +13,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <unity.h>
 #include "../cache_sim.h"
 
@@ -23,6 +27,7 @@ int ret;
 uint8_t tag;
 uint32_t t_block_size = 64;
 uint32_t cache_length;
+uint32_t cache_ways;
 uint32_t cache_size;
 cache_bits_t cache_bits;
 cache_map_t cache_mapping;
@@ -35,7 +40,7 @@ cache_org_t cache_org;
  * cache block size is 64-bytes
  * cache is FIFO
  * command line args:
- *      cache size in bytes or kB (128 - 4096B)
+ *      cache size in bytes, kB or MB (128B - 64MB)
  *      cache mapping: direct mapped or fully associative
  *      cache organization: unified or split
  *          split: data and instruction each get half of total cache size
@@ -58,18 +63,20 @@ void test_set_cache_bits_dm_uc(void)
 
     cache_size = 128;
     cache_length = cache_size / t_block_size;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(1, cache_bits.index);
-    tag = 32-6-1;
+    tag = 64-6-1;
     TEST_ASSERT_EQUAL_UINT8(tag, cache_bits.tag);
 
     cache_size = 4096;
     cache_length = cache_size / t_block_size;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.index);
-    tag = 32-6-6;
+    tag = 64-6-6;
     TEST_ASSERT_EQUAL_UINT8(tag, cache_bits.tag);
 }
 
@@ -80,18 +87,20 @@ void test_set_cache_bits_dm_sc(void)
 
     cache_size = 128;
     cache_length = cache_size / t_block_size / 2;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(0, cache_bits.index);
-    tag = 32-6;
+    tag = 64-6;
     TEST_ASSERT_EQUAL_UINT8(tag, cache_bits.tag);
 
     cache_size = 4096;
     cache_length = cache_size / t_block_size / 2;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8_MESSAGE(5, cache_bits.index, "Unexpected index bits");
-    tag = 32-6-5;
+    tag = 64-6-5;
     TEST_ASSERT_EQUAL_UINT8(tag, cache_bits.tag);
 }
 
@@ -102,17 +111,19 @@ void test_set_cache_bits_fa_uc(void)
 
     cache_size = 128;
     cache_length = cache_size / t_block_size;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(0, cache_bits.index);
-    TEST_ASSERT_EQUAL_UINT8(26, cache_bits.tag);
+    TEST_ASSERT_EQUAL_UINT8(64-6, cache_bits.tag);
 
     cache_size = 4096;
     cache_length = cache_size / t_block_size;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(0, cache_bits.index);
-    TEST_ASSERT_EQUAL_UINT8(26, cache_bits.tag);
+    TEST_ASSERT_EQUAL_UINT8(64-6, cache_bits.tag);
 }
 
 void test_set_cache_bits_fa_sc(void)
@@ -122,20 +133,135 @@ void test_set_cache_bits_fa_sc(void)
 
     cache_size = 128;
     cache_length = cache_size / t_block_size / 2;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(0, cache_bits.index);
-    TEST_ASSERT_EQUAL_UINT8(26, cache_bits.tag);
+    TEST_ASSERT_EQUAL_UINT8(64-6, cache_bits.tag);
 
     cache_size = 4096;
     cache_length = cache_size / t_block_size / 2;
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
     TEST_ASSERT_EQUAL_UINT8(0, cache_bits.index);
-    TEST_ASSERT_EQUAL_UINT8(26, cache_bits.tag);
+    TEST_ASSERT_EQUAL_UINT8(64-6, cache_bits.tag);
 }
 
 
+void test_set_cache_bits_sa_uc(void)
+{
+    cache_mapping = sa;
+    cache_org = uc;
+
+    /* 4096B, 4-way: 64 blocks in 16 sets */
+    cache_size = 4096;
+    cache_length = cache_size / t_block_size;
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 4);
+    TEST_ASSERT_EQUAL_UINT32(4, cache_ways);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+    TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
+    TEST_ASSERT_EQUAL_UINT8(4, cache_bits.index);
+    TEST_ASSERT_EQUAL_UINT8(64-6-4, cache_bits.tag);
+}
+
+void test_set_cache_bits_sa_32MB(void)
+{
+    cache_mapping = sa;
+    cache_org = uc;
+
+    /* 32MB, 16-way: 524288 blocks in 32768 sets */
+    cache_size = parse_cache_size("32M");
+    TEST_ASSERT_EQUAL_UINT32(32U << 20, cache_size);
+    TEST_ASSERT_EQUAL_INT(0, verify_cache_size(cache_size));
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    TEST_ASSERT_EQUAL_UINT32(524288, cache_length);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 16);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+    TEST_ASSERT_EQUAL_UINT8(6, cache_bits.offset);
+    TEST_ASSERT_EQUAL_UINT8(15, cache_bits.index);
+    TEST_ASSERT_EQUAL_UINT8(64-6-15, cache_bits.tag);
+}
+
+void test_verify_cache_size(void)
+{
+    TEST_ASSERT_EQUAL_INT(-1, verify_cache_size(64));
+    TEST_ASSERT_EQUAL_INT(0, verify_cache_size(128));
+    TEST_ASSERT_EQUAL_INT(0, verify_cache_size(parse_cache_size("4096")));
+    TEST_ASSERT_EQUAL_INT(0, verify_cache_size(parse_cache_size("256K")));
+    TEST_ASSERT_EQUAL_INT(-1, verify_cache_size(parse_cache_size("3000")));
+    TEST_ASSERT_EQUAL_INT(-1, verify_cache_size(parse_cache_size("128M")));
+}
+
+void test_block_size(void)
+{
+    cache_config_t config;
+    cache_sim_t sim;
+
+    TEST_ASSERT_EQUAL_INT(-1, verify_block_size(8));
+    TEST_ASSERT_EQUAL_INT(0, verify_block_size(16));
+    TEST_ASSERT_EQUAL_INT(-1, verify_block_size(48));
+    TEST_ASSERT_EQUAL_INT(0, verify_block_size(256));
+    TEST_ASSERT_EQUAL_INT(-1, verify_block_size(512));
+
+    /* 4096B SA 4-way UC with 32B blocks: 128 blocks in 32 sets */
+    cache_length = get_cache_length(4096, uc, 32);
+    TEST_ASSERT_EQUAL_UINT32(128, cache_length);
+    set_cache_bits(&cache_bits, cache_length, 4, sa, uc, 32);
+    TEST_ASSERT_EQUAL_UINT32(5, cache_bits.offset);
+    TEST_ASSERT_EQUAL_UINT32(5, cache_bits.index);
+    TEST_ASSERT_EQUAL_UINT32(64-5-5, cache_bits.tag);
+
+    TEST_ASSERT_EQUAL_UINT32(8, get_cache_length(4096, sc, 256));
+
+    /* A split 128B cache cannot hold a 256B block */
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "128", "dm", "sc", 1));
+    config.block = 256;
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_init(&sim, &config));
+
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "4096", "sa", "uc", 4));
+    TEST_ASSERT_EQUAL_UINT32(64, config.block);
+    config.block = 16;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+    TEST_ASSERT_EQUAL_UINT32(256, sim.length);
+    TEST_ASSERT_EQUAL_UINT32(4, sim.bits.offset);
+    cache_sim_deinit(&sim);
+}
+
+void test_64bit_addresses(void)
+{
+    mem_access_t access;
+    cache_t cache;
+    int hits = 0;
+
+    TEST_ASSERT_EQUAL_UINT64(0xffffffffULL, MASK(32));
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, MASK(64));
+
+    /* dm uc, 4096 size: a 48 bit virtual address */
+    set_cache_bits(&cache_bits, 64, 1, dm, uc, t_block_size);
+    TEST_ASSERT_EQUAL_UINT8(52, cache_bits.tag);
+    access.address = 0x7ffd8cda3fa8ULL;
+    set_access_identifiers(&access, cache_bits);
+    TEST_ASSERT_EQUAL_HEX32(0x3E, access.index);
+    TEST_ASSERT_EQUAL_UINT64(0x7ffd8cda3ULL, access.tag);
+
+    /* Blocks whose tags only differ above bit 32 must not alias */
+    set_cache_bits(&cache_bits, 4, 4, fa, uc, t_block_size);
+    TEST_ASSERT_EQUAL_INT(0, cache_init(&cache, 4, 4, rp_lru));
+    const uint64_t address[] = {
+        0x40, 0x7ffd00000040ULL, 0x555500000040ULL, 0x40, 0x7ffd00000040ULL
+    };
+    for (int i = 0; i < 5; i++) {
+        access.address = address[i];
+        set_access_identifiers(&access, cache_bits);
+        hits += access_cache_fa(&cache, &access);
+    }
+    TEST_ASSERT_EQUAL_INT(2, hits);
+    TEST_ASSERT_NOT_NULL(cache.tag_hi);
+    TEST_ASSERT_EQUAL_INT(-1, cache_lookup(&cache, 0, 0x12340000001ULL));
+    cache_deinit(&cache);
+}
+
 /**     allocate cache      **/
 void test_cache_init(void)
 {
@@ -145,24 +271,22 @@ void test_cache_init(void)
     uint8_t length;
 
     length = 1;
-    err = cache_init(&cache_small, length);
+    err = cache_init(&cache_small, length, 1, rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "return unexpected");
     TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache_small.length, "unexpected length of cache");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_small.block->byte[0], "unexpected byte offset value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_small.block->tag, "unexpected tag value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_small.block->valid, "unexpected valid value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_small.tag[0], "unexpected tag value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, BLOCK_VALID(&cache_small, 0), "unexpected valid value");
 
     length = 64;
-    err = cache_init(&cache_large, length);
+    err = cache_init(&cache_large, length, 1, rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "return unexpected");
     TEST_ASSERT_EQUAL_UINT32_MESSAGE(64, cache_large.length, "unexpected length of cache");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block->byte[0], "unexpected byte offset value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block->tag, "unexpected tag value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block->valid, "unexpected valid value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block[20].tag, "unexpected tag value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block[20].valid, "unexpected valid value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block[63].tag, "unexpected tag value");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.block[63].valid, "unexpected valid value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.tag[0], "unexpected tag value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, BLOCK_VALID(&cache_large, 0), "unexpected valid value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.tag[20], "unexpected tag value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, BLOCK_VALID(&cache_large, 20), "unexpected valid value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache_large.tag[63], "unexpected tag value");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, BLOCK_VALID(&cache_large, 63), "unexpected valid value");
 }
 
 /**     set_access_identifiers      **/
@@ -215,11 +339,12 @@ void test_access_cache_dm_128B(void)
     cache_bits.tag = 0;
     access.accesstype = data;   /* This doesn't matter */
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    err = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    err = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "cache_init() unexpected return");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     printf("Cache bits: offset: %d, idx: %d, tag: %d\n", cache_bits.offset, cache_bits.index, cache_bits.tag);
 
     /* First in a series of accesses, should be compulsory miss */
@@ -227,73 +352,73 @@ void test_access_cache_dm_128B(void)
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
     /* Verify offset here */
 
     /* Same address, expect hit */
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(1, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* New address within first index, same tag, expect cache hit (no offset!) */
     access.address = 0x0000003f;
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(1, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* Same index, new tag, expect miss */
     access.address = 0xff00001f;
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* Same index, first tag, expect miss */
     access.address = 0x0000001f;
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* Second index, expect miss */
     access.address = 0x00000040;
     set_access_identifiers(&access, cache_bits);
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == false, "Valid bit should not be set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, 0, "Tag should be zero");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == false, "Valid bit should not be set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], 0, "Tag should be zero");
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* Second index, new tag, expect miss */
     access.address = 0xff000040;
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* Second index, first tag, expect miss */
     access.address = 0x0000004a;
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /* Second index, first tag, new offset, expect hit */
     access.address = 0x0000004a;
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(1, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 }
 
 void test_access_cache_dm_128B_mem_trace_1(void)
@@ -310,11 +435,12 @@ void test_access_cache_dm_128B_mem_trace_1(void)
     cache_bits.tag = 0;
     access.accesstype = data;   /* This doesn't matter */
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    err = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    err = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "cache_init() unexpected return");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     printf("Cache bits: offset: %d, idx: %d, tag: %d\n", cache_bits.offset, cache_bits.index, cache_bits.tag);
 
     /*  0x8cda3fa8
@@ -329,8 +455,8 @@ void test_access_cache_dm_128B_mem_trace_1(void)
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /*  0x8158bf94
         10000001010110001011111110010100
@@ -397,11 +523,12 @@ void test_access_cache_dm_4096B_mem_trace_1(void)
     cache_bits.tag = 0;
     access.accesstype = data;   /* This doesn't matter */
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    err = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    err = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "cache_init() unexpected return");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     printf("Cache bits: offset: %d, idx: %d, tag: %d\n", cache_bits.offset, cache_bits.index, cache_bits.tag);
 
     /*  0x8cda3fa8
@@ -416,8 +543,8 @@ void test_access_cache_dm_4096B_mem_trace_1(void)
     set_access_identifiers(&access, cache_bits);
     err = access_cache_dm(&cache, &access);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "access_cache_dm() unexpected return");
-    TEST_ASSERT_TRUE_MESSAGE(cache.block[access.index].valid == true, "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.block[access.index].tag, access.tag, "Unexpected tag");
+    TEST_ASSERT_TRUE_MESSAGE(BLOCK_VALID(&cache, access.index) == true, "Valid bit not set");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(cache.tag[access.index], access.tag, "Unexpected tag");
 
     /*  0x8158bf94
         10000001010110001011111110010100
@@ -487,11 +614,12 @@ void test_access_cache_fa_128B_mem_trace_1(void)
     cache_bits.tag = 0;
     access.accesstype = data;   /* This doesn't matter for uc */
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    err = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    err = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "cache_init() unexpected return");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     printf("Cache bits: offset: %d, idx: %d, tag: %d\n", cache_bits.offset, cache_bits.index, cache_bits.tag);
 
     /*  0x8cda3fa8
@@ -567,11 +695,12 @@ void test_access_cache_fa_4096B_mem_trace_1(void)
     cache_bits.tag = 0;
     access.accesstype = data;   /* This doesn't matter for uc */
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    err = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    err = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, err, "cache_init() unexpected return");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
     printf("Cache bits: offset: %d, idx: %d, tag: %d\n", cache_bits.offset, cache_bits.index, cache_bits.tag);
 
     /*  0x8cda3fa8
@@ -639,15 +768,16 @@ void test_transfer_address_to_cache(void)
     cache_t cache;
     mem_access_t access;
 
-    cache_mapping = uc;
-    cache_org = fa;
+    cache_mapping = fa;
+    cache_org = sc;
     cache_size = 1024;
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    ret = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    ret = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
 
     /*  0x8cda3fa8
         10001100110110100011111110101000
@@ -656,15 +786,15 @@ void test_transfer_address_to_cache(void)
     access.address = 0x8cda3fa8;
     set_access_identifiers(&access, cache_bits);
     transfer_address_to_cache(&cache, &access);
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.start,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.set[0].start,
         "Start pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.end,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.set[0].end,
         "End pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.is_full,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.set[0].is_full,
         "is_full member should not be set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.block[0].valid,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, BLOCK_VALID(&cache, 0),
         "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(access.tag, cache.block[0].tag,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(access.tag, cache.tag[0],
         "Unexpected tag bits");
 
     /*  0x8158bf94
@@ -674,15 +804,15 @@ void test_transfer_address_to_cache(void)
     access.address = 0x8158bf94;
     set_access_identifiers(&access, cache_bits);
     transfer_address_to_cache(&cache, &access);
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.start,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.set[0].start,
         "Start pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, cache.end,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, cache.set[0].end,
         "End pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.is_full,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.set[0].is_full,
         "is_full member should not be set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.block[1].valid,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, BLOCK_VALID(&cache, 1),
         "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(access.tag, cache.block[1].tag,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(access.tag, cache.tag[1],
         "Unexpected tag bits");
 }
 
@@ -696,11 +826,12 @@ void test_transfer_address_to_cache_is_full(void)
     cache_mapping = fa;
     cache_size = 128;
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    ret = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    ret = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
 
     access.address = 0x00000000;
     set_access_identifiers(&access, cache_bits);
@@ -715,19 +846,19 @@ void test_transfer_address_to_cache_is_full(void)
     set_access_identifiers(&access, cache_bits);
     transfer_address_to_cache(&cache, &access);
 
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.start,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.set[0].start,
         "Start pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.end,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.set[0].end,
         "End pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.is_full,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.set[0].is_full,
         "is_full member should not be set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.block[0].valid,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, BLOCK_VALID(&cache, 0),
         "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.block[1].valid,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, BLOCK_VALID(&cache, 1),
         "Valid bit not set");
-    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x2336531, cache.block[0].tag,
+    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x2336531, cache.tag[0],
         "Unexpected tag bits");
-    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x20562FE, cache.block[1].tag,
+    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x20562FE, cache.tag[1],
         "Unexpected tag bits");
 
     /* Should overwrite 2nd entry */
@@ -735,19 +866,19 @@ void test_transfer_address_to_cache_is_full(void)
     set_access_identifiers(&access, cache_bits);
     transfer_address_to_cache(&cache, &access);
 
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.start,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.set[0].start,
         "Start pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.end,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, cache.set[0].end,
         "End pointer incorrect");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.is_full,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.set[0].is_full,
         "is_full member should not be set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.block[0].valid,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, BLOCK_VALID(&cache, 0),
         "Valid bit not set");
-    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, cache.block[1].valid,
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, BLOCK_VALID(&cache, 1),
         "Valid bit not set");
-    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x2336531, cache.block[0].tag,
+    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x2336531, cache.tag[0],
         "Unexpected tag bits");
-    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x0, cache.block[1].tag,
+    TEST_ASSERT_EQUAL_HEX_MESSAGE(0x0, cache.tag[1],
         "Unexpected tag bits");
 }
 
@@ -761,11 +892,12 @@ void test_is_address_in_fa_cache(void)
     cache_mapping = fa;
     cache_size = 256;
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    ret = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    ret = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
 
     /* Cache is empty */
     ret = is_address_in_fa_cache(&cache, &access);
@@ -818,11 +950,12 @@ void test_access_cache_fa(void)
     cache_mapping = fa;
     cache_size = 256;
 
-    cache_length = get_cache_length(cache_size, cache_org);
-    ret = cache_init(&cache, cache_length);
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    ret = cache_init(&cache, cache_length, get_cache_ways(cache_length, cache_mapping, 1), rp_fifo);
     TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
 
-    set_cache_bits(&cache_bits, cache_length, cache_mapping, cache_org);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
 
     /* Item 1/4 */
     access.address = 0x00000000;
@@ -873,6 +1006,1346 @@ void test_access_cache_fa(void)
     TEST_ASSERT_EQUAL(0, ret);
 }
 
+void test_access_cache_sa(void)
+{
+    int ret;
+    cache_t cache;
+    mem_access_t access;
+
+    /* 256B, 2-way: 2 sets of 2 blocks */
+    cache_org = uc;
+    cache_mapping = sa;
+    cache_size = 256;
+
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 2);
+    ret = cache_init(&cache, cache_length, cache_ways, rp_fifo);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
+    TEST_ASSERT_EQUAL_UINT32(2, cache.sets);
+
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+
+    /* Set 0, way 0 */
+    access.address = 0x00000000;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+
+    /* Set 1 does not disturb set 0 */
+    access.address = 0x00000040;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+    access.address = 0x00001040;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+    access.address = 0x00002040;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+
+    /* Hit */
+    access.address = 0x00000010;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(1, ret);
+
+    /* Set 0, way 1, then evict 0x00000000 */
+    access.address = 0x00001000;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+    access.address = 0x00002000;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+    access.address = 0x00000000;
+    set_access_identifiers(&access, cache_bits);
+    ret = access_cache_sa(&cache, &access);
+    TEST_ASSERT_EQUAL(0, ret);
+
+    cache_deinit(&cache);
+}
+
+void test_cache_lookup_tag_index(void)
+{
+    int ret;
+    cache_t cache;
+    mem_access_t access;
+
+    /* 32KB fully associative: 512 ways, uses the hashed tag index */
+    cache_org = uc;
+    cache_mapping = fa;
+    cache_size = 32768;
+
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    ret = cache_init(&cache, cache_length, cache_ways, rp_fifo);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
+    TEST_ASSERT_TRUE_MESSAGE(cache.hash != NULL, "Tag index not allocated");
+
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+
+    /* Fill twice over, so every block has been evicted once */
+    for (uint32_t i = 0; i < 2 * cache_ways; i++) {
+        access.address = i << 6;
+        set_access_identifiers(&access, cache_bits);
+        TEST_ASSERT_EQUAL(0, access_cache_fa(&cache, &access));
+    }
+
+    /* Only the second round is left, each at the way it was placed in */
+    for (uint32_t i = 0; i < 2 * cache_ways; i++) {
+        ret = cache_lookup(&cache, 0, i);
+        if (i < cache_ways) {
+            TEST_ASSERT_EQUAL(-1, ret);
+        } else {
+            TEST_ASSERT_EQUAL(i - cache_ways, ret);
+        }
+    }
+
+    cache_deinit(&cache);
+}
+
+void test_read_transaction(void)
+{
+    const uint32_t records = 200000;
+    mem_access_t access;
+    trace_t trace;
+    FILE *file;
+
+    /* Trailing blanks, CRLF, blank lines and 0x prefixes, and enough
+     * records to cross several read blocks */
+    file = fopen("parse.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "I 8cda3fa8 \n\nD\t0x8158BF94\r\n");
+    for (uint32_t i = 0; i < records; i++) {
+        fprintf(file, "%c %x   \n", (i & 1) ? 'D' : 'I', i * 64 + 1);
+    }
+    fclose(file);
+
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "parse.txt"));
+
+    TEST_ASSERT_EQUAL_INT(1, read_transaction(&trace, &access));
+    TEST_ASSERT_EQUAL_HEX32(0x8cda3fa8, access.address);
+    TEST_ASSERT_EQUAL_INT(instruction, access.accesstype);
+    TEST_ASSERT_EQUAL_INT(1, read_transaction(&trace, &access));
+    TEST_ASSERT_EQUAL_HEX32(0x8158bf94, access.address);
+    TEST_ASSERT_EQUAL_INT(data, access.accesstype);
+
+    for (uint32_t i = 0; i < records; i++) {
+        TEST_ASSERT_EQUAL_INT(1, read_transaction(&trace, &access));
+        TEST_ASSERT_EQUAL_HEX32(i * 64 + 1, access.address);
+        TEST_ASSERT_EQUAL_INT((i & 1) ? data : instruction, access.accesstype);
+    }
+
+    /* End of trace */
+    TEST_ASSERT_EQUAL_INT(0, read_transaction(&trace, &access));
+
+    trace_close(&trace);
+    remove("parse.txt");
+}
+
+void test_trace_convert(void)
+{
+    trace_enc_t encodings[] = { enc_fixed32, enc_fixed64, enc_delta };
+    mem_access_t expected;
+    mem_access_t access;
+    trace_t text;
+    trace_t binary;
+
+    for (int i = 0; i < 3; i++) {
+        ret = trace_convert("testcases/m0hit.txt", "m0hit.trc", encodings[i]);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "trace_convert() failed");
+
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&text, "testcases/m0hit.txt"));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&binary, "m0hit.trc"));
+        TEST_ASSERT_TRUE_MESSAGE(binary.map != NULL, "Binary trace not mapped");
+        TEST_ASSERT_EQUAL_UINT64(10, binary.count);
+
+        /* Binary trace replays the text trace exactly */
+        while (trace_read(&text, &expected)) {
+            TEST_ASSERT_EQUAL_INT(1, trace_read(&binary, &access));
+            TEST_ASSERT_EQUAL_HEX32_MESSAGE(expected.address, access.address, "Unexpected address");
+            TEST_ASSERT_EQUAL_INT(expected.accesstype, access.accesstype);
+        }
+        TEST_ASSERT_EQUAL_INT(0, trace_read(&binary, &access));
+
+        trace_close(&text);
+        trace_close(&binary);
+    }
+    remove("m0hit.trc");
+}
+
+void test_trace_compressed(void)
+{
+    mem_access_t expected;
+    mem_access_t access;
+    trace_t text;
+    trace_t packed;
+
+    /* Text and binary traces read the same through a decompressor */
+    TEST_ASSERT_EQUAL_INT(0, system("gzip -c testcases/m0hit.txt > m0hit.txt.gz"));
+    TEST_ASSERT_EQUAL_INT(0, trace_convert("testcases/m0hit.txt", "m0hit.trc", enc_delta));
+    TEST_ASSERT_EQUAL_INT(0, system("gzip -c m0hit.trc > m0hit.trc.gz"));
+
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&text, "testcases/m0hit.txt"));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&packed, i ? "m0hit.trc.gz" : "m0hit.txt.gz"));
+        TEST_ASSERT_EQUAL_INT(i, packed.map != NULL);
+        while (trace_read(&text, &expected)) {
+            TEST_ASSERT_EQUAL_INT(1, trace_read(&packed, &access));
+            TEST_ASSERT_EQUAL_HEX32(expected.address, access.address);
+            TEST_ASSERT_EQUAL_INT(expected.accesstype, access.accesstype);
+        }
+        TEST_ASSERT_EQUAL_INT(0, trace_read(&packed, &access));
+        trace_close(&text);
+        trace_close(&packed);
+    }
+
+    /* The other decompressors, where they are installed */
+    const char *tools[] = { "zstd", "xz", "bzip2" };
+    for (size_t t = 0; t < sizeof(tools) / sizeof(tools[0]); t++) {
+        char command[128];
+        int records = 0;
+
+        snprintf(command, sizeof(command), "command -v %s > /dev/null 2>&1", tools[t]);
+        if (system(command) != 0) {
+            continue;
+        }
+        snprintf(command, sizeof(command), "%s -c m0hit.trc > m0hit.trc.packed", tools[t]);
+        TEST_ASSERT_EQUAL_INT(0, system(command));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&text, "testcases/m0hit.txt"));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&packed, "m0hit.trc.packed"));
+        TEST_ASSERT_NOT_NULL(packed.map);
+        while (trace_read(&text, &expected)) {
+            TEST_ASSERT_EQUAL_INT(1, trace_read(&packed, &access));
+            TEST_ASSERT_EQUAL_HEX32(expected.address, access.address);
+            records++;
+        }
+        TEST_ASSERT_EQUAL_INT(0, trace_read(&packed, &access));
+        TEST_ASSERT_TRUE(records > 0);
+        trace_close(&text);
+        trace_close(&packed);
+        remove("m0hit.trc.packed");
+    }
+
+    remove("m0hit.txt.gz");
+    remove("m0hit.trc");
+    remove("m0hit.trc.gz");
+}
+
+void test_trace_stdin_early_exit(void)
+{
+    mem_access_t access;
+    trace_t trace;
+    struct sigaction action;
+    const char *old_path = getenv("PATH");
+    char path[4096];
+    FILE *file;
+    int saved_stdin;
+
+    /* A gzip stand-in that prints two records after reading a byte */
+    TEST_ASSERT_EQUAL_INT(0, system("mkdir -p fakebin && printf '#!/bin/sh\n"
+                                    "head -c 1 > /dev/null\nprintf \"R 10\\nW 20\\n\"\n'"
+                                    " > fakebin/gzip && chmod +x fakebin/gzip"));
+    snprintf(path, sizeof(path), "fakebin:%s", old_path ? old_path : "");
+    TEST_ASSERT_EQUAL_INT(0, setenv("PATH", path, 1));
+
+    /* Megabytes of "compressed" input it never reads */
+    file = fopen("early.gz", "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    fputc(0x1f, file);
+    fputc(0x8b, file);
+    for (int i = 0; i < (4 << 20); i++) {
+        fputc(0, file);
+    }
+    fclose(file);
+
+    saved_stdin = dup(STDIN_FILENO);
+    TEST_ASSERT_TRUE(freopen("early.gz", "rb", stdin) != NULL);
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "-"));
+    TEST_ASSERT_EQUAL_INT(1, trace_read(&trace, &access));
+    TEST_ASSERT_EQUAL_HEX32(0x10, access.address);
+    TEST_ASSERT_EQUAL_INT(1, trace_read(&trace, &access));
+    TEST_ASSERT_EQUAL_INT(1, access.write);
+    TEST_ASSERT_EQUAL_INT(0, trace_read(&trace, &access));
+    TEST_ASSERT_EQUAL_INT(0, trace_read(&trace, &access));
+    trace_close(&trace);
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    if (old_path) {
+        setenv("PATH", old_path, 1);
+    }
+
+    /* The feeder's EPIPE left the process wide SIGPIPE handling alone */
+    TEST_ASSERT_EQUAL_INT(0, sigaction(SIGPIPE, NULL, &action));
+    TEST_ASSERT_TRUE(action.sa_handler == SIG_DFL);
+
+    remove("early.gz");
+    system("rm -rf fakebin");
+}
+
+void test_trace_read_address_zero(void)
+{
+    static access_batch_t batch;
+    trace_t trace;
+    FILE *file;
+
+    /* Address 0 is a regular access, not the end of the trace */
+    file = fopen("zero.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "D 0\nI 40\nD 0\n");
+    fclose(file);
+
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "zero.txt"));
+    TEST_ASSERT_EQUAL_UINT32(3, trace_read_batch(&trace, &batch));
+    TEST_ASSERT_EQUAL_HEX32(0x0, batch.address[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x40, batch.address[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x0, batch.address[2]);
+    TEST_ASSERT_EQUAL_UINT32(0, trace_read_batch(&trace, &batch));
+    trace_close(&trace);
+
+    /* Same for binary traces */
+    TEST_ASSERT_EQUAL_INT(0, trace_convert("zero.txt", "zero.trc", enc_delta));
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "zero.trc"));
+    TEST_ASSERT_EQUAL_UINT32(3, trace_read_batch(&trace, &batch));
+    TEST_ASSERT_EQUAL_HEX32(0x0, batch.address[2]);
+    TEST_ASSERT_EQUAL_INT(data, batch.type[2]);
+    TEST_ASSERT_EQUAL_UINT32(0, trace_read_batch(&trace, &batch));
+    trace_close(&trace);
+
+    remove("zero.txt");
+    remove("zero.trc");
+}
+
+void test_trace_oversized_count(void)
+{
+    const uint32_t encodings[] = { enc_fixed64, enc_fixed32 };
+    const uint64_t counts[] = { 1ULL << 61, 4340410370284600380ULL };
+    trace_header_t header;
+    uint8_t records[64];
+    trace_t trace;
+    FILE *file;
+
+    /* Record counts far beyond the file are rejected, however they wrap */
+    memset(records, 0, sizeof(records));
+    for (int i = 0; i < 2; i++) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "CSIMTRC", sizeof(header.magic));
+        header.version = 2;
+        header.encoding = encodings[i];
+        header.count = counts[i];
+        file = fopen("oversized.trc", "wb");
+        TEST_ASSERT_NOT_NULL(file);
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(records, sizeof(records), 1, file);
+        fclose(file);
+        TEST_ASSERT_EQUAL_INT(-1, trace_open(&trace, "oversized.trc"));
+    }
+
+    remove("oversized.trc");
+}
+
+/* Reads every record of path in a child, returns its exit status: 0 if a
+ * record was rejected, 3 if all were read
+ */
+static int read_trace_in_child(const char *path)
+{
+    mem_access_t access;
+    trace_t trace;
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        if (trace_open(&trace, path)) {
+            _exit(2);
+        }
+        while (trace_read(&trace, &access)) {
+        }
+        _exit(3);
+    }
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void test_read_transaction_long_address(void)
+{
+    FILE *file;
+
+    /* 16 hex digits are a full 64 bit address */
+    file = fopen("long.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "D ffffffffffffffff\nI 0x0123456789abcdef\n");
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(3, read_trace_in_child("long.txt"));
+
+    /* A 17th digit is malformed instead of wrapping around */
+    file = fopen("long.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "D 40\nD 10000000000000040\n");
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(0, read_trace_in_child("long.txt"));
+
+    remove("long.txt");
+}
+
+void test_cache_lookup_simd(void)
+{
+    int ret;
+    cache_t cache;
+    mem_access_t access;
+
+    /* 4096B 32-way: 2 sets, compared with the SIMD kernels */
+    cache_org = uc;
+    cache_mapping = sa;
+    cache_size = 4096;
+
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 32);
+    ret = cache_init(&cache, cache_length, cache_ways, rp_fifo);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, ret, "cache_init() failed");
+    TEST_ASSERT_TRUE_MESSAGE(cache.hash == NULL, "Tag index should not be allocated");
+
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+
+    /* Tag 0 matches every empty way, only valid ways may hit */
+    TEST_ASSERT_EQUAL(-1, cache_lookup(&cache, 1, 0));
+
+    /* Fill set 1 with tags 0..30, leaving the last way empty */
+    for (uint32_t i = 0; i < cache_ways - 1; i++) {
+        access.address = (i << 7) | 0x40;
+        set_access_identifiers(&access, cache_bits);
+        TEST_ASSERT_EQUAL(0, access_cache_sa(&cache, &access));
+    }
+
+    for (uint32_t i = 0; i < cache_ways - 1; i++) {
+        TEST_ASSERT_EQUAL(i, cache_lookup(&cache, 1, i));
+        TEST_ASSERT_EQUAL(-1, cache_lookup(&cache, 0, i));
+    }
+    TEST_ASSERT_EQUAL(-1, cache_lookup(&cache, 1, cache_ways - 1));
+
+    cache_deinit(&cache);
+}
+
+void test_access_cache_batch(void)
+{
+    static access_batch_t batch;
+    static access_ids_t ids;
+    cache_t cache_inst;
+    cache_t cache_data;
+    cache_t *caches[2] = { &cache_inst, &cache_data };
+    trace_t trace;
+    uint64_t hits;
+
+    /* m100hit.txt on a 4096B split direct mapped cache */
+    cache_org = sc;
+    cache_mapping = dm;
+    cache_size = 4096;
+
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    TEST_ASSERT_EQUAL_INT(0, cache_init(&cache_inst, cache_length, cache_ways, rp_fifo));
+    TEST_ASSERT_EQUAL_INT(0, cache_init(&cache_data, cache_length, cache_ways, rp_fifo));
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "testcases/m100hit.txt"));
+    TEST_ASSERT_EQUAL_UINT32(10, trace_read_batch(&trace, &batch));
+    trace_close(&trace);
+
+    set_access_identifiers_batch(&batch, cache_bits, &ids);
+    /* 0x8cda3fa8: index 0x1e, tag 0x119b47 */
+    TEST_ASSERT_EQUAL_HEX32(0x1e, ids.index[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x119b47, ids.tag[0]);
+
+    /* One compulsory miss in each cache, everything else hits */
+    hits = access_cache_batch(caches, cache_mapping, &batch, &ids);
+    TEST_ASSERT_EQUAL_UINT64(8, hits);
+
+    cache_deinit(&cache_inst);
+    cache_deinit(&cache_data);
+}
+
+void test_cache_sim_run_batch(void)
+{
+    static access_batch_t batch;
+    cache_config_t config;
+    cache_sim_t sims[2];
+    trace_t trace;
+
+    /* Two configurations driven from the same parsed batch */
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "4096", "dm", "sc", 1));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sims[0], &config));
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "128", "fa", "uc", 1));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sims[1], &config));
+    TEST_ASSERT_EQUAL_INT(-1, parse_cache_config(&config, "4096", "xx", "uc", 1));
+
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "testcases/m100hit.txt"));
+    while (trace_read_batch(&trace, &batch) > 0) {
+        cache_sim_run_batch(&sims[0], &batch);
+        cache_sim_run_batch(&sims[1], &batch);
+    }
+    trace_close(&trace);
+
+    /* Split: one compulsory miss per cache. Unified 2 blocks: the two
+     * streams map to different blocks and do not evict each other */
+    TEST_ASSERT_EQUAL_UINT64(10, sims[0].stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(8, sims[0].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(10, sims[1].stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(8, sims[1].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(0, sims[1].stats.evicts);
+
+    cache_sim_deinit(&sims[0]);
+    cache_sim_deinit(&sims[1]);
+}
+
+void test_write_policies(void)
+{
+    static access_batch_t batch;
+    const char *names[] = {"wb", "wt", "wb-nwa", "wt-nwa"};
+    const uint64_t hits[] = {2, 2, 1, 1};
+    const uint64_t writebacks[] = {1, 0, 0, 0};
+    const uint64_t read_bytes[] = {384, 384, 192, 192};
+    const uint64_t write_bytes[] = {64, 16, 16, 16};
+    cache_config_t config;
+    write_policy_t write;
+    cache_sim_t sim;
+    trace_t trace;
+
+    /* 2 block LRU cache: the dirty block 0 is the only one evicted while
+     * dirty, blocks 3 and 4 are still dirty at the end of the trace */
+    for (int w = 0; w < 4; w++) {
+        TEST_ASSERT_EQUAL_INT(0, parse_write_policy(&write, names[w]));
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "128", "fa", "uc", 1));
+        config.policy = rp_lru;
+        config.write = write;
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "testcases/writes.txt"));
+        while (trace_read_batch(&trace, &batch) > 0) {
+            cache_sim_run_batch(&sim, &batch);
+        }
+        trace_close(&trace);
+
+        TEST_ASSERT_EQUAL_UINT64(8, sim.stats.accesses);
+        TEST_ASSERT_EQUAL_UINT64(4, sim.stats.writes);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(hits[w], sim.stats.hits, names[w]);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(writebacks[w], sim.stats.writebacks, names[w]);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(read_bytes[w], sim.stats.read_bytes, names[w]);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(write_bytes[w], sim.stats.write_bytes, names[w]);
+        cache_sim_deinit(&sim);
+    }
+
+    TEST_ASSERT_EQUAL_INT(-1, parse_write_policy(&write, "wa"));
+}
+
+void test_prefetchers(void)
+{
+    static access_batch_t batch;
+    const char *names[] = {"next", "stride", "stream"};
+    const uint64_t hits[] = {15, 13, 15};
+    const uint64_t prefetches[] = {16, 15, 19};
+    cache_config_t config;
+    cache_sim_t sim;
+
+    /* 16 sequential blocks through a 4096B DM cache. Stride needs the
+     * same stride twice before it prefetches, stream buffers are
+     * allocated on the first miss.
+     */
+    batch.len = 16;
+    batch.writes = 0;
+    for (int i = 0; i < 16; i++) {
+        batch.address[i] = i * 64;
+        batch.type[i] = data;
+        batch.write[i] = 0;
+    }
+    for (int p = 0; p < 3; p++) {
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "4096", "dm", "uc", 1));
+        TEST_ASSERT_EQUAL_INT(0, parse_prefetcher(&config.prefetch, names[p]));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+        cache_sim_run_batch(&sim, &batch);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(hits[p], sim.stats.hits, names[p]);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(prefetches[p], sim.stats.prefetches, names[p]);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(hits[p], sim.stats.useful_prefetches, names[p]);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, sim.stats.useless_prefetches, names[p]);
+        cache_sim_deinit(&sim);
+    }
+
+    /* 128B DM: prefetching block 2 evicts block 0, which misses again */
+    batch.len = 3;
+    batch.address[0] = 0x0;
+    batch.address[1] = 0x40;
+    batch.address[2] = 0x0;
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "128", "dm", "uc", 1));
+    config.prefetch = pf_next_line;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+    cache_sim_run_batch(&sim, &batch);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(2, sim.stats.prefetches);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.useful_prefetches);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.useless_prefetches);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.prefetch_evicts);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.pollution_misses);
+    cache_sim_deinit(&sim);
+
+    /* A descending stride stops prefetching at address 0 */
+    batch.len = 5;
+    for (int i = 0; i < 5; i++) {
+        batch.address[i] = (4 - i) * 64;
+    }
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "4096", "dm", "uc", 1));
+    config.prefetch = pf_stride;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+    cache_sim_run_batch(&sim, &batch);
+    TEST_ASSERT_EQUAL_UINT64(2, sim.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(2, sim.stats.prefetches);
+    cache_sim_deinit(&sim);
+
+    TEST_ASSERT_EQUAL_INT(-1, parse_prefetcher(&config.prefetch, "markov"));
+}
+
+void test_victim_cache_and_3c(void)
+{
+    static access_batch_t batch;
+    const uint64_t addresses[] = {0x0, 0x80, 0x0, 0x80, 0x100, 0x0};
+    cache_config_t config;
+    cache_sim_t sim;
+
+    /* A B A B C A in the one set of a 128B DM cache */
+    batch.len = 6;
+    batch.writes = 0;
+    for (int i = 0; i < 6; i++) {
+        batch.address[i] = addresses[i];
+        batch.type[i] = data;
+        batch.write[i] = 0;
+    }
+
+    /* A 2 block fully associative cache holds A and B but not A after C */
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "128", "dm", "uc", 1));
+    config.classify = true;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+    cache_sim_run_batch(&sim, &batch);
+    TEST_ASSERT_EQUAL_UINT64(0, sim.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(3, sim.stats.compulsory_misses);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.capacity_misses);
+    TEST_ASSERT_EQUAL_UINT64(2, sim.stats.conflict_misses);
+    cache_sim_deinit(&sim);
+
+    /* A one block victim cache swaps A and B, C pushes A out of it */
+    config.victim = 1;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+    cache_sim_run_batch(&sim, &batch);
+    TEST_ASSERT_EQUAL_UINT64(2, sim.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(2, sim.stats.victim_hits);
+    TEST_ASSERT_EQUAL_UINT64(3, sim.stats.compulsory_misses);
+    TEST_ASSERT_EQUAL_UINT64(1, sim.stats.capacity_misses);
+    TEST_ASSERT_EQUAL_UINT64(0, sim.stats.conflict_misses);
+    cache_sim_deinit(&sim);
+
+    config.victim = VICTIM_MAX_BLOCKS + 1;
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_init(&sim, &config));
+}
+
+void test_cache_sim_run_trace(void)
+{
+    const char *policies[] = {"fifo", "lru", "plru", "srrip"};
+    cache_config_t config;
+    cache_sim_t serial;
+    cache_sim_t parallel;
+    trace_t trace;
+    FILE *file;
+    uint64_t x = 1;
+
+    file = fopen("sets.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    for (int i = 0; i < 20000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        fprintf(file, "%c %x\n", "IRW"[i % 3], (uint32_t)(x >> 40) & 0x3ffff);
+    }
+    fclose(file);
+
+    /* Set partitioned runs match the serial run exactly */
+    for (int p = 0; p < 4; p++) {
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "16384", "sa", "sc", 4));
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_policy(&config.policy, policies[p]));
+
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&serial, &config));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "sets.txt"));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&serial, &trace, 1));
+        trace_close(&trace);
+
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&parallel, &config));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "sets.txt"));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&parallel, &trace, 3));
+        trace_close(&trace);
+
+        TEST_ASSERT_EQUAL_UINT64(20000, parallel.stats.accesses);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(serial.stats.hits, parallel.stats.hits, policies[p]);
+        TEST_ASSERT_EQUAL_UINT64(serial.stats.evicts, parallel.stats.evicts);
+        TEST_ASSERT_EQUAL_UINT64(serial.stats.writebacks, parallel.stats.writebacks);
+        TEST_ASSERT_EQUAL_UINT64(serial.stats.read_bytes, parallel.stats.read_bytes);
+        cache_sim_deinit(&serial);
+        cache_sim_deinit(&parallel);
+    }
+
+    remove("sets.txt");
+}
+
+void test_cache_sim_run_trace_dm(void)
+{
+    const char *orgs[] = {"uc", "sc"};
+    const write_policy_t writes[] = {wp_wb, wp_wt};
+    cache_config_t config;
+    cache_sim_t serial;
+    cache_sim_t parallel;
+    trace_t trace;
+    FILE *file;
+    uint64_t x = 1;
+
+    /* Long enough for several chunks per thread */
+    file = fopen("chunks.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    for (int i = 0; i < 1200000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        fprintf(file, "%c %x\n", "IRW"[(x >> 20) % 3], (uint32_t)(x >> 40) & 0x7fff);
+    }
+    fclose(file);
+
+    /* Chunk parallel runs of small direct mapped caches match the serial run */
+    for (int c = 0; c < 2; c++) {
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "4096", "dm", orgs[c], 1));
+        config.write = writes[c];
+
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&serial, &config));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "chunks.txt"));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&serial, &trace, 1));
+        trace_close(&trace);
+
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&parallel, &config));
+        TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "chunks.txt"));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&parallel, &trace, 4));
+        trace_close(&trace);
+
+        TEST_ASSERT_EQUAL_UINT64(1200000, parallel.stats.accesses);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(serial.stats.hits, parallel.stats.hits, orgs[c]);
+        TEST_ASSERT_EQUAL_UINT64(serial.stats.evicts, parallel.stats.evicts);
+        TEST_ASSERT_EQUAL_UINT64(serial.stats.writebacks, parallel.stats.writebacks);
+        TEST_ASSERT_EQUAL_UINT64(serial.stats.write_bytes, parallel.stats.write_bytes);
+        cache_sim_deinit(&serial);
+        cache_sim_deinit(&parallel);
+    }
+
+    remove("chunks.txt");
+}
+
+void test_set_sampling(void)
+{
+    cache_config_t config;
+    cache_sim_t exact;
+    cache_sim_t sampled;
+    trace_t trace;
+    FILE *file;
+    uint64_t x = 1;
+    double rate, ci;
+
+    file = fopen("sample.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    for (int i = 0; i < 200000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        /* A hot region and uniform accesses over 4 MB */
+        fprintf(file, "%c %x\n", "RRW"[i % 3],
+                (uint32_t)(x >> 40) & (((x >> 20) & 1) ? 0x3fffff : 0x3ffff));
+    }
+    fclose(file);
+
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "256K", "sa", "uc", 4));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&exact, &config));
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "sample.txt"));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&exact, &trace, 1));
+    trace_close(&trace);
+
+    /* 1 in 8 of 1024 sets, every access is still counted */
+    config.sample = 8;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sampled, &config));
+    TEST_ASSERT_NOT_NULL(sampled.sampler);
+    TEST_ASSERT_TRUE(sampled.sampler->sampled > 96 && sampled.sampler->sampled < 160);
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "sample.txt"));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&sampled, &trace, 4));
+    trace_close(&trace);
+
+    TEST_ASSERT_EQUAL_UINT64(exact.stats.accesses, sampled.stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(exact.stats.writes, sampled.stats.writes);
+    rate = (double)sampled.stats.hits / sampled.stats.accesses;
+    ci = cache_sim_hit_rate_ci(&sampled);
+    TEST_ASSERT_TRUE(ci > 0.0 && ci < 0.05);
+    TEST_ASSERT_FLOAT_WITHIN(ci, (double)exact.stats.hits / exact.stats.accesses, rate);
+    TEST_ASSERT_TRUE(cache_sim_hit_rate_ci(&exact) == 0.0);
+    cache_sim_deinit(&exact);
+    cache_sim_deinit(&sampled);
+
+    /* Too few sets left, and a single set cannot be sampled */
+    config.sample = 128;
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_init(&sampled, &config));
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "256K", "fa", "uc", 4));
+    config.sample = 8;
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_init(&sampled, &config));
+
+    remove("sample.txt");
+}
+
+void test_checkpoint(void)
+{
+    cache_config_t config;
+    cache_sim_t full;
+    cache_sim_t warm;
+    trace_t trace;
+    FILE *file;
+    uint64_t x = 1;
+    uint64_t offset = 0;
+
+    file = fopen("checkpoint.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    for (int i = 0; i < 100000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        /* Some tags need more than 32 bits */
+        fprintf(file, "%c %" PRIx64 "\n", "RIW"[i % 3],
+                (x >> 44) | (((x >> 20) & 7) == 0 ? (x & 0xff) << 40 : 0));
+    }
+    fclose(file);
+
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, "64K", "sa", "sc", 8));
+    config.policy = rp_lru;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&full, &config));
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "checkpoint.txt"));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&full, &trace, 1));
+    trace_close(&trace);
+
+    /* Stop part way and checkpoint */
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&warm, &config));
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "checkpoint.txt"));
+    trace.limit = 40000;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&warm, &trace, 1));
+    trace_close(&trace);
+    TEST_ASSERT_EQUAL_UINT64(40000, warm.stats.accesses);
+    TEST_ASSERT_NOT_NULL(warm.cache[data].tag_hi);
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_save(&warm, "checkpoint.bin"));
+    cache_sim_deinit(&warm);
+
+    /* Continuing from the checkpoint ends like the uninterrupted run */
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&warm, &config));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_restore(&warm, "checkpoint.bin", &offset));
+    TEST_ASSERT_EQUAL_UINT64(40000, offset);
+    TEST_ASSERT_NOT_NULL(warm.snapshot);
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, "checkpoint.txt"));
+    TEST_ASSERT_EQUAL_UINT64(offset, trace_skip(&trace, offset));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&warm, &trace, 4));
+    trace_close(&trace);
+
+    TEST_ASSERT_EQUAL_UINT64(full.stats.accesses, warm.stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(full.stats.hits, warm.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(full.stats.evicts, warm.stats.evicts);
+    TEST_ASSERT_EQUAL_UINT64(full.stats.writebacks, warm.stats.writebacks);
+    for (int c = 0; c < 2; c++) {
+        TEST_ASSERT_EQUAL_INT(0, memcmp(full.cache[c].tag, warm.cache[c].tag,
+                                        full.cache[c].length * sizeof(uint32_t)));
+        TEST_ASSERT_EQUAL_INT(0, memcmp(full.cache[c].meta, warm.cache[c].meta,
+                                        2 * full.cache[c].length * sizeof(uint32_t)));
+    }
+    cache_sim_deinit(&warm);
+    cache_sim_deinit(&full);
+
+    /* Only the configuration it was taken with restores it */
+    config.policy = rp_fifo;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&warm, &config));
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_restore(&warm, "checkpoint.bin", &offset));
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_restore(&warm, "checkpoint.txt", &offset));
+    cache_sim_deinit(&warm);
+    config.prefetch = pf_next_line;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&warm, &config));
+    TEST_ASSERT_EQUAL_INT(-1, cache_sim_save(&warm, "checkpoint.bin"));
+    cache_sim_deinit(&warm);
+
+    remove("checkpoint.txt");
+    remove("checkpoint.bin");
+}
+
+/* Redirects stdout to path until capture_end(), reports are checked from
+ * what they print
+ */
+static int capture_begin(const char *path)
+{
+    int saved;
+    int fd;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    return saved;
+}
+
+static void capture_end(int saved)
+{
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+void test_run_sweep(void)
+{
+    char serial_line[512];
+    char parallel_line[512];
+    FILE *serial;
+    FILE *parallel;
+    FILE *file;
+    uint64_t x = 1;
+    uint64_t accesses;
+    int rows = 0;
+    int saved;
+    int ret[2];
+
+    file = fopen("sweep.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    for (int i = 0; i < 30000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        fprintf(file, "%c %x\n", "IRW"[i % 3], (uint32_t)(x >> 40) & 0x7fff);
+    }
+    fclose(file);
+
+    /* The thread pool gives every configuration the serial statistics */
+    saved = capture_begin("sweep_serial.out");
+    ret[0] = run_sweep("testcases/sweep.cfg", "sweep.txt", 1);
+    capture_end(saved);
+    saved = capture_begin("sweep_parallel.out");
+    ret[1] = run_sweep("testcases/sweep.cfg", "sweep.txt", 4);
+    capture_end(saved);
+    TEST_ASSERT_EQUAL_INT(0, ret[0]);
+    TEST_ASSERT_EQUAL_INT(0, ret[1]);
+
+    serial = fopen("sweep_serial.out", "r");
+    parallel = fopen("sweep_parallel.out", "r");
+    TEST_ASSERT_NOT_NULL(serial);
+    TEST_ASSERT_NOT_NULL(parallel);
+    while (fgets(serial_line, sizeof(serial_line), serial)) {
+        TEST_ASSERT_NOT_NULL(fgets(parallel_line, sizeof(parallel_line), parallel));
+        TEST_ASSERT_EQUAL_STRING(serial_line, parallel_line);
+        /* Rows start with the cache size, accesses are the 10th column */
+        if (serial_line[0] >= '0' && serial_line[0] <= '9') {
+            TEST_ASSERT_EQUAL_INT(1, sscanf(serial_line, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %"
+                                            SCNu64, &accesses));
+            TEST_ASSERT_EQUAL_UINT64(30000, accesses);
+            rows++;
+        }
+    }
+    TEST_ASSERT_NULL(fgets(parallel_line, sizeof(parallel_line), parallel));
+    TEST_ASSERT_EQUAL_INT(16, rows);
+    fclose(serial);
+    fclose(parallel);
+
+    TEST_ASSERT_EQUAL_INT(-1, run_sweep("testcases/missing.cfg", "testcases/mem_trace1.txt", 4));
+
+    remove("sweep.txt");
+    remove("sweep_serial.out");
+    remove("sweep_parallel.out");
+}
+
+/* Accesses with reuse at every distance up to 16K lines */
+static void write_reuse_trace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    uint64_t x = 1;
+
+    TEST_ASSERT_NOT_NULL(file);
+    for (int i = 0; i < 50000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        fprintf(file, "%c %x\n", "IRW"[i % 3],
+                (uint32_t)(x >> 40) & (((x >> 20) & 1) ? 0xfffff : 0x3fff));
+    }
+    fclose(file);
+}
+
+/* Hits of a fully associative LRU unified cache of size bytes */
+static uint64_t lru_hits(const char *path, uint32_t size, uint64_t *accesses)
+{
+    cache_config_t config;
+    cache_sim_t sim;
+    trace_t trace;
+    char name[16];
+    uint64_t hits;
+
+    snprintf(name, sizeof(name), "%u", size);
+    TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, name, "fa", "uc", 1));
+    config.policy = rp_lru;
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&sim, &config));
+    TEST_ASSERT_EQUAL_INT(0, trace_open(&trace, path));
+    TEST_ASSERT_EQUAL_INT(0, cache_sim_run_trace(&sim, &trace, 1));
+    trace_close(&trace);
+    hits = sim.stats.hits;
+    if (accesses) {
+        *accesses = sim.stats.accesses;
+    }
+    cache_sim_deinit(&sim);
+    return hits;
+}
+
+void test_stack_distance(void)
+{
+    char line[256];
+    FILE *file;
+    uint32_t size, blocks;
+    uint64_t hits;
+    int rows = 0;
+    int saved;
+    int ret;
+    stack_dist_t sd;
+    /* A B C A B D A A: distances inf inf inf 2 2 inf 2 0 */
+    const uint32_t lines[] = {1, 2, 3, 1, 2, 4, 1, 1};
+
+    TEST_ASSERT_EQUAL_INT(0, stack_dist_init(&sd));
+    for (int i = 0; i < 8; i++) {
+        stack_dist_access(&sd, lines[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT64(8, sd.accesses);
+    TEST_ASSERT_EQUAL_UINT64(4, sd.cold);
+    TEST_ASSERT_EQUAL_UINT64(1, stack_dist_hits(&sd, 1));
+    TEST_ASSERT_EQUAL_UINT64(1, stack_dist_hits(&sd, 2));
+    TEST_ASSERT_EQUAL_UINT64(4, stack_dist_hits(&sd, 4));
+    stack_dist_deinit(&sd);
+
+    /* Cycling over more lines than the time slots forces renumbering */
+    TEST_ASSERT_EQUAL_INT(0, stack_dist_init(&sd));
+    for (uint32_t i = 0; i < 3 * STACK_DIST_MIN_CAPACITY; i++) {
+        stack_dist_access(&sd, i % 1000);
+    }
+    TEST_ASSERT_EQUAL_UINT64(1000, sd.cold);
+    TEST_ASSERT_EQUAL_UINT64(0, stack_dist_hits(&sd, 512));
+    TEST_ASSERT_EQUAL_UINT64(3 * STACK_DIST_MIN_CAPACITY - 1000, stack_dist_hits(&sd, 1024));
+    stack_dist_deinit(&sd);
+
+    TEST_ASSERT_EQUAL_INT(0, run_stack_distance("testcases/mem_trace1.txt", sc, t_block_size));
+
+    /* Every size of the report hits like a fully associative LRU cache */
+    write_reuse_trace("reuse.txt");
+    saved = capture_begin("reuse.out");
+    ret = run_stack_distance("reuse.txt", uc, t_block_size);
+    capture_end(saved);
+    TEST_ASSERT_EQUAL_INT(0, ret);
+
+    file = fopen("reuse.out", "r");
+    TEST_ASSERT_NOT_NULL(file);
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%u %u %" SCNu64, &size, &blocks, &hits) == 3 && size <= 16384) {
+            TEST_ASSERT_EQUAL_UINT64(lru_hits("reuse.txt", size, NULL), hits);
+            rows++;
+        }
+    }
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(8, rows);
+
+    remove("reuse.txt");
+    remove("reuse.out");
+}
+
+void test_replacement_policies(void)
+{
+    /* Block numbers accessed in a 256B fully associative cache of 4 ways */
+    const uint32_t blocks[] = {0, 1, 2, 3, 0, 4, 0, 1, 0, 5, 2, 0, 6, 3, 1};
+    const char *names[] = {"fifo", "lru", "plru", "bitplru", "random", "lfu", "srrip"};
+    const int expected_hits[] = {3, 4, 5, 4, 4, 6, 4};
+    cache_policy_t policy;
+    mem_access_t access;
+    cache_t cache;
+    int hits;
+
+    cache_org = uc;
+    cache_mapping = fa;
+    cache_size = 256;
+    cache_length = get_cache_length(cache_size, cache_org, t_block_size);
+    cache_ways = get_cache_ways(cache_length, cache_mapping, 1);
+    set_cache_bits(&cache_bits, cache_length, cache_ways, cache_mapping, cache_org, t_block_size);
+
+    for (int p = 0; p < 7; p++) {
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_policy(&policy, names[p]));
+        TEST_ASSERT_EQUAL_INT(p, policy);
+        TEST_ASSERT_EQUAL_INT(0, cache_init(&cache, cache_length, cache_ways, policy));
+
+        hits = 0;
+        for (int i = 0; i < 15; i++) {
+            access.address = blocks[i] * 64;
+            set_access_identifiers(&access, cache_bits);
+            hits += access_cache_fa(&cache, &access);
+        }
+        TEST_ASSERT_EQUAL_INT_MESSAGE(expected_hits[p], hits, names[p]);
+        TEST_ASSERT_EQUAL_UINT64(15 - 4 - hits, cache.evicts);
+        cache_deinit(&cache);
+    }
+
+    TEST_ASSERT_EQUAL_INT(-1, parse_cache_policy(&policy, "mru"));
+}
+
+void test_cache_sim_kernels(void)
+{
+    static access_batch_t batch;
+    const char *configs[][4] = {
+        {"4096", "dm", "sc", "fifo"}, {"8192", "fa", "uc", "lru"},
+        {"16K", "sa", "sc", "plru"}, {"16K", "sa", "uc", "srrip"},
+        {"64K", "sa", "sc", "lfu"}, {"64K", "sa", "uc", "bitplru"},
+    };
+    const uint32_t assoc[] = {1, 1, 2, 8, 16, 32};
+    cache_config_t config;
+    cache_sim_t kernel, generic;
+    uint64_t seed = 1;
+
+    /* Random accesses, clustered so that all caches see hits */
+    batch.len = TRACE_BATCH;
+    for (size_t i = 0; i < batch.len; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        batch.address[i] = (uint32_t)(seed >> 33) & 0x3ffff;
+        batch.type[i] = (seed >> 20) & 1;
+    }
+
+    /* The specialized kernel and the generic path agree */
+    for (int c = 0; c < 6; c++) {
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_config(&config, configs[c][0], configs[c][1],
+                                                    configs[c][2], assoc[c]));
+        TEST_ASSERT_EQUAL_INT(0, parse_cache_policy(&config.policy, configs[c][3]));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&kernel, &config));
+        TEST_ASSERT_EQUAL_INT(0, cache_sim_init(&generic, &config));
+
+        cache_sim_run_batch(&kernel, &batch);
+        cache_sim_run_batch(&kernel, &batch);
+        uint64_t hits = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            set_access_identifiers_batch(&batch, generic.bits, generic.ids);
+            hits += access_cache_batch(generic.caches, config.mapping, &batch, generic.ids);
+        }
+
+        TEST_ASSERT_TRUE(hits > 0);
+        TEST_ASSERT_EQUAL_UINT64(hits, kernel.stats.hits);
+        TEST_ASSERT_EQUAL_UINT64(generic.cache[0].evicts + generic.cache[1].evicts,
+                                 kernel.stats.evicts);
+        cache_sim_deinit(&kernel);
+        cache_sim_deinit(&generic);
+    }
+}
+
+/* Runs A B A C A D A E A B B through a 2 block L1 and a 4 block L2 */
+static void run_hierarchy_sequence(hierarchy_t *hierarchy, const char *inclusion)
+{
+    const uint32_t blocks[] = {0, 1, 0, 2, 0, 3, 0, 4, 0, 1, 1};
+    FILE *file = fopen("hierarchy.cfg", "w");
+
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "inclusion %s\n128 fa uc 0 lru 2\n256 fa uc 0 lru 10\nmemory 100\n", inclusion);
+    fclose(file);
+
+    TEST_ASSERT_EQUAL_INT(0, hierarchy_init(hierarchy, "hierarchy.cfg"));
+    TEST_ASSERT_EQUAL_UINT32(2, hierarchy->levels);
+    for (int i = 0; i < 11; i++) {
+        hierarchy_access(hierarchy, blocks[i] * 64, data);
+    }
+    remove("hierarchy.cfg");
+}
+
+void test_hierarchy(void)
+{
+    hierarchy_t hierarchy;
+
+    /* L2 evicts A while it is hot in L1, only NINE keeps it there */
+    run_hierarchy_sequence(&hierarchy, "nine");
+    TEST_ASSERT_EQUAL_UINT64(11, hierarchy.level[0].stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(5, hierarchy.level[0].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(6, hierarchy.level[1].stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(1, hierarchy.level[1].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(5, hierarchy.memory_accesses);
+    /* (11 * 2 + 6 * 10 + 5 * 100) / 11 cycles */
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 582.0 / 11, hierarchy_amat(&hierarchy));
+    hierarchy_deinit(&hierarchy);
+
+    run_hierarchy_sequence(&hierarchy, "inclusive");
+    TEST_ASSERT_EQUAL_UINT64(4, hierarchy.level[0].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(7, hierarchy.level[1].stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(0, hierarchy.level[1].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(7, hierarchy.memory_accesses);
+    hierarchy_deinit(&hierarchy);
+
+    /* L2 only holds L1 victims, B comes back from L2 */
+    run_hierarchy_sequence(&hierarchy, "exclusive");
+    TEST_ASSERT_EQUAL_UINT64(5, hierarchy.level[0].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(6, hierarchy.level[1].stats.accesses);
+    TEST_ASSERT_EQUAL_UINT64(1, hierarchy.level[1].stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(5, hierarchy.memory_accesses);
+    hierarchy_deinit(&hierarchy);
+
+    TEST_ASSERT_EQUAL_INT(0, run_hierarchy("testcases/hierarchy.cfg", "testcases/mem_trace1.txt"));
+    TEST_ASSERT_EQUAL_INT(-1, hierarchy_init(&hierarchy, "testcases/missing.cfg"));
+}
+
+void test_shards(void)
+{
+    char line[256];
+    FILE *file;
+    uint32_t size, blocks;
+    uint64_t hits, accesses;
+    double ratio;
+    int rows = 0;
+    int saved;
+    int ret;
+    stack_dist_t sd;
+    shards_t exact;
+    shards_t sampled;
+    uint64_t x = 1;
+
+    /* Distances of A B C A B D A A */
+    const uint32_t lines[] = {1, 2, 3, 1, 2, 4, 1, 1};
+    const uint32_t distances[] = {STACK_DIST_COLD, STACK_DIST_COLD, STACK_DIST_COLD,
+                                  2, 2, STACK_DIST_COLD, 2, 0};
+
+    TEST_ASSERT_EQUAL_INT(0, stack_dist_init(&sd));
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL_UINT32(distances[i], stack_dist_access(&sd, lines[i]));
+    }
+    stack_dist_deinit(&sd);
+
+    /* A hot set of 2K lines and a cold set of 256K lines */
+    TEST_ASSERT_EQUAL_INT(0, stack_dist_init(&sd));
+    TEST_ASSERT_EQUAL_INT(0, shards_init(&exact, 1 << 20));
+    TEST_ASSERT_EQUAL_INT(0, shards_init(&sampled, 16384));
+    for (int i = 0; i < 1000000; i++) {
+        uint64_t line;
+
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        line = ((x >> 60) < 12) ? (x >> 20) % 2048 : 2048 + (x >> 20) % 262144;
+        stack_dist_access(&sd, line);
+        shards_access(&exact, line);
+        shards_access(&sampled, line);
+    }
+
+    /* Everything fits the budget, the curve is exact */
+    TEST_ASSERT_EQUAL_UINT32(SHARDS_MODULUS, exact.threshold);
+    for (uint32_t blocks = 1; blocks <= (1 << 20); blocks <<= 1) {
+        TEST_ASSERT_FLOAT_WITHIN(1e-9, 1.0 - (double)stack_dist_hits(&sd, blocks) / 1000000,
+                                 shards_miss_ratio(&exact, blocks));
+    }
+
+    /* The sampling rate drops to keep 16384 lines, the curve stays close */
+    TEST_ASSERT_TRUE(sampled.threshold < SHARDS_MODULUS / 8);
+    TEST_ASSERT_TRUE(sampled.sd.active <= 16384);
+    TEST_ASSERT_EQUAL_UINT32(sampled.sd.active, sampled.heap_len);
+    for (uint32_t blocks = 1024; blocks <= (1 << 20); blocks <<= 2) {
+        TEST_ASSERT_FLOAT_WITHIN(0.02, shards_miss_ratio(&exact, blocks),
+                                 shards_miss_ratio(&sampled, blocks));
+    }
+    stack_dist_deinit(&sd);
+    shards_deinit(&exact);
+    shards_deinit(&sampled);
+
+    TEST_ASSERT_EQUAL_INT(-1, shards_init(&sampled, 0));
+    TEST_ASSERT_EQUAL_INT(0, run_mrc("testcases/mem_trace1.txt", sc, t_block_size, 1024));
+
+    /* Tracking every line, the curve is the miss ratio of LRU caches */
+    write_reuse_trace("reuse.txt");
+    saved = capture_begin("mrc.out");
+    ret = run_mrc("reuse.txt", uc, t_block_size, 1 << 16);
+    capture_end(saved);
+    TEST_ASSERT_EQUAL_INT(0, ret);
+
+    file = fopen("mrc.out", "r");
+    TEST_ASSERT_NOT_NULL(file);
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%uK %u %lf", &size, &blocks, &ratio) == 3 && size <= 16) {
+            hits = lru_hits("reuse.txt", size * 1024, &accesses);
+            TEST_ASSERT_FLOAT_WITHIN(0.0001, 1.0 - (double)hits / accesses, ratio);
+            rows++;
+        }
+    }
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(5, rows);
+
+    remove("reuse.txt");
+    remove("mrc.out");
+}
+
+/* Core 0 reads A, core 1 reads and writes it, core 0 reads and writes it
+ * again, then reads and writes B
+ */
+static void run_coherence_sequence(coherence_t *coh, const char *protocol)
+{
+    const uint32_t cores[] = {0, 1, 1, 0, 0, 0, 0};
+    const uint32_t blocks[] = {0, 0, 0, 0, 0, 1, 1};
+    const bool writes[] = {false, false, true, false, true, false, true};
+    FILE *file = fopen("coherence.cfg", "w");
+
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "protocol %s\ncores 2\n4096 sa uc 4 lru\n", protocol);
+    fclose(file);
+
+    TEST_ASSERT_EQUAL_INT(0, coherence_init(coh, "coherence.cfg", 0));
+    TEST_ASSERT_EQUAL_UINT32(2, coh->cores);
+    for (int i = 0; i < 7; i++) {
+        coherence_access(coh, cores[i], blocks[i] * 64, data, writes[i]);
+    }
+    remove("coherence.cfg");
+}
+
+void test_coherence(void)
+{
+    coherence_t coh;
+    FILE *file;
+
+    /* Core 1's write invalidates A in core 0, whose read then misses */
+    run_coherence_sequence(&coh, "mesi");
+    TEST_ASSERT_EQUAL_UINT64(2, coh.core[0].sim.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.core[1].sim.stats.hits);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.core[0].coherence_misses);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.core[0].invalidations);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.core[1].invalidations);
+    TEST_ASSERT_EQUAL_UINT64(4, coh.bus_reads);
+    TEST_ASSERT_EQUAL_UINT64(0, coh.bus_read_exclusives);
+    /* B is exclusive, its write needs no upgrade */
+    TEST_ASSERT_EQUAL_UINT64(2, coh.bus_upgrades);
+    /* The modified A is written back when core 0 shares it */
+    TEST_ASSERT_EQUAL_UINT64(1, coh.writebacks);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.transfers);
+    coherence_deinit(&coh);
+
+    run_coherence_sequence(&coh, "msi");
+    TEST_ASSERT_EQUAL_UINT64(3, coh.bus_upgrades);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.writebacks);
+    coherence_deinit(&coh);
+
+    /* Core 1 keeps A owned, dirty, until core 0 writes it */
+    run_coherence_sequence(&coh, "moesi");
+    TEST_ASSERT_EQUAL_UINT64(2, coh.bus_upgrades);
+    TEST_ASSERT_EQUAL_UINT64(0, coh.writebacks);
+    TEST_ASSERT_EQUAL_UINT64(1, coh.transfers);
+    coherence_deinit(&coh);
+
+    /* Core tagged records, a core past the configured ones is an error */
+    file = fopen("coherence.cfg", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "protocol moesi\ncores 2\n128 dm uc\n");
+    fclose(file);
+    file = fopen("cores.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "R 40 0\nW 0x40\t1\nR 40 0\n");
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(0, run_coherence("coherence.cfg", (const char *[]){"cores.txt"}, 1));
+    file = fopen("cores.txt", "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fprintf(file, "R 40 0\nR 40 2\n");
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(-1, run_coherence("coherence.cfg", (const char *[]){"cores.txt"}, 1));
+    /* Three traces for two configured cores */
+    TEST_ASSERT_EQUAL_INT(-1, run_coherence("coherence.cfg",
+                          (const char *[]){"cores.txt", "cores.txt", "cores.txt"}, 3));
+    remove("cores.txt");
+    remove("coherence.cfg");
+}
+
 /**     Test main      **/
 int main(void)
 {
@@ -882,6 +2355,11 @@ int main(void)
     RUN_TEST(test_set_cache_bits_dm_sc);
     RUN_TEST(test_set_cache_bits_fa_uc);
     RUN_TEST(test_set_cache_bits_fa_sc);
+    RUN_TEST(test_set_cache_bits_sa_uc);
+    RUN_TEST(test_set_cache_bits_sa_32MB);
+    RUN_TEST(test_verify_cache_size);
+    RUN_TEST(test_block_size);
+    RUN_TEST(test_64bit_addresses);
 
     RUN_TEST(test_cache_init);
 
@@ -895,6 +2373,33 @@ int main(void)
     RUN_TEST(test_transfer_address_to_cache_is_full);
     RUN_TEST(test_is_address_in_fa_cache);
     RUN_TEST(test_access_cache_fa);
+    RUN_TEST(test_access_cache_sa);
+    RUN_TEST(test_cache_lookup_tag_index);
+    RUN_TEST(test_cache_lookup_simd);
+    RUN_TEST(test_access_cache_batch);
+    RUN_TEST(test_cache_sim_run_batch);
+    RUN_TEST(test_cache_sim_kernels);
+    RUN_TEST(test_replacement_policies);
+    RUN_TEST(test_write_policies);
+    RUN_TEST(test_prefetchers);
+    RUN_TEST(test_victim_cache_and_3c);
+    RUN_TEST(test_cache_sim_run_trace);
+    RUN_TEST(test_cache_sim_run_trace_dm);
+    RUN_TEST(test_set_sampling);
+    RUN_TEST(test_checkpoint);
+    RUN_TEST(test_run_sweep);
+    RUN_TEST(test_hierarchy);
+    RUN_TEST(test_coherence);
+    RUN_TEST(test_stack_distance);
+    RUN_TEST(test_shards);
+
+    RUN_TEST(test_read_transaction);
+    RUN_TEST(test_trace_convert);
+    RUN_TEST(test_trace_compressed);
+    RUN_TEST(test_trace_stdin_early_exit);
+    RUN_TEST(test_trace_read_address_zero);
+    RUN_TEST(test_read_transaction_long_address);
+    RUN_TEST(test_trace_oversized_count);
 
     return UNITY_END();
 }